@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# Records the /proc and /sys files read by i3status modules into a compact
+# trace and replays such a trace through i3status, so that modules can be
+# tested and their cost measured on machines without (for example) a battery
+# or a Wi-Fi card.
+#
+# Recording takes a snapshot of all files every --interval seconds. Only the
+# files which changed since the previous snapshot are stored:
+#
+#     contrib/replay.py record -o laptop.trace --count 120
+#
+# Replaying writes the first snapshot into a temporary directory, starts
+# i3status with fs_root pointing to it, and then for every following snapshot
+# rewrites the changed files in place (modules keep some of them open),
+# sends SIGUSR1 and reads the resulting status line. The lines are compared
+# with an expected output (if given) and the time from the signal to the
+# status line is reported:
+#
+#     contrib/replay.py replay laptop.trace -c test.conf --save laptop.out
+#     contrib/replay.py replay laptop.trace -c test.conf --expect laptop.out
+#
+# The config is copied with fs_root, output_format and interval in the
+# general section replaced. Time-dependent modules (time, tztime, ddate) and
+# modules not reading files (disk, volume, ethernet) will of course not
+# produce reproducible output.
+#
+# The trace format is gzip-compressed JSON lines, one per snapshot:
+#     {"t": <seconds since the start>, "files": {<path>: <contents>}}
+# where contents is null for files which disappeared.
+
+import argparse
+import glob
+import gzip
+import json
+import os
+import re
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+DEFAULT_PATTERNS = [
+    '/proc/stat',
+    '/proc/loadavg',
+    '/proc/meminfo',
+    '/proc/diskstats',
+    '/proc/net/wireless',
+    '/proc/pressure/*',
+    '/sys/class/power_supply/*/uevent',
+    '/sys/class/thermal/thermal_zone*/temp',
+    '/sys/class/hwmon/hwmon*/temp*_input',
+    '/sys/devices/system/cpu/cpufreq/policy*/scaling_cur_freq',
+    '/sys/devices/system/cpu/cpufreq/policy*/scaling_governor',
+    '/sys/devices/system/cpu/cpufreq/policy*/related_cpus',
+]
+
+
+def snapshot(patterns):
+    files = {}
+    for pattern in patterns:
+        for path in glob.glob(pattern):
+            try:
+                with open(path, 'r', errors='replace') as f:
+                    files[path] = f.read()
+            except OSError:
+                pass
+    return files
+
+
+def record(args):
+    patterns = args.patterns or DEFAULT_PATTERNS
+    previous = {}
+    start = time.monotonic()
+    with gzip.open(args.output, 'wt') as out:
+        for i in range(args.count):
+            if i > 0:
+                time.sleep(args.interval)
+            current = snapshot(patterns)
+            delta = {path: content for path, content in current.items()
+                     if previous.get(path) != content}
+            delta.update({path: None for path in previous if path not in current})
+            out.write(json.dumps({'t': round(time.monotonic() - start, 3),
+                                  'files': delta}) + '\n')
+            previous = current
+    print('recorded %d snapshots to %s' % (args.count, args.output))
+
+
+def read_trace(path):
+    with gzip.open(path, 'rt') as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+
+def apply_snapshot(root, files):
+    for path, content in files.items():
+        target = root + path
+        if content is None:
+            if os.path.exists(target):
+                os.unlink(target)
+            continue
+        os.makedirs(os.path.dirname(target), exist_ok=True)
+        # Rewrite the file in place instead of replacing it: modules keep
+        # some files open and would not notice a new inode.
+        mode = 'r+' if os.path.exists(target) else 'w'
+        with open(target, mode) as f:
+            f.write(content)
+            f.truncate()
+
+
+def write_config(config, root, output):
+    with open(config) as f:
+        lines = f.readlines()
+    lines = [l for l in lines
+             if not re.match(r'\s*(fs_root|output_format|interval)\s*=', l)]
+    text = ''.join(lines)
+    general = ('general {\n\tfs_root = "%s"\n\toutput_format = "none"\n'
+               '\tinterval = 3600\n' % root)
+    if re.search(r'^\s*general\s*\{', text, re.M):
+        text = re.sub(r'^\s*general\s*\{\n?', general, text, count=1, flags=re.M)
+    else:
+        text = general + '}\n' + text
+    with open(output, 'w') as f:
+        f.write(text)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, max(0, int(p * len(values) + 0.999999) - 1))]
+
+
+def replay(args):
+    trace = read_trace(args.trace)
+    if not trace:
+        sys.exit('empty trace')
+
+    with tempfile.TemporaryDirectory(prefix='i3status-replay-') as root:
+        apply_snapshot(root, trace[0]['files'])
+        config = os.path.join(root, 'i3status.conf')
+        write_config(args.config, root, config)
+
+        proc = subprocess.Popen([args.i3status, '-c', config],
+                                stdout=subprocess.PIPE, universal_newlines=True)
+        lines = [proc.stdout.readline().rstrip('\n')]
+        timings = []
+        try:
+            for frame in trace[1:]:
+                apply_snapshot(root, frame['files'])
+                begin = time.perf_counter()
+                proc.send_signal(signal.SIGUSR1)
+                line = proc.stdout.readline()
+                timings.append((time.perf_counter() - begin) * 1000)
+                if not line:
+                    sys.exit('i3status exited unexpectedly')
+                lines.append(line.rstrip('\n'))
+        finally:
+            proc.terminate()
+            proc.wait()
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            f.write('\n'.join(lines) + '\n')
+
+    failed = 0
+    if args.expect:
+        with open(args.expect) as f:
+            expected = f.read().splitlines()
+        for i, (got, want) in enumerate(zip(lines, expected)):
+            if got != want:
+                failed += 1
+                print('snapshot %d:\n  expected: %s\n  got:      %s' % (i, want, got))
+        if len(lines) != len(expected):
+            failed += 1
+            print('expected %d lines, got %d' % (len(expected), len(lines)))
+
+    if timings:
+        print('%d snapshots, signal to status line: min %.2f ms, median %.2f ms, p99 %.2f ms'
+              % (len(lines), min(timings), percentile(timings, 0.5), percentile(timings, 0.99)))
+    if failed:
+        sys.exit('%d mismatches' % failed)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Record and replay /proc and /sys snapshots for i3status.')
+    sub = parser.add_subparsers(dest='command')
+    sub.required = True
+
+    rec = sub.add_parser('record', help='record a trace')
+    rec.add_argument('-o', '--output', required=True)
+    rec.add_argument('-n', '--count', type=int, default=60)
+    rec.add_argument('-i', '--interval', type=float, default=1.0)
+    rec.add_argument('patterns', nargs='*',
+                     help='glob patterns of files to record (default: files read by modules)')
+    rec.set_defaults(func=record)
+
+    rep = sub.add_parser('replay', help='replay a trace through i3status')
+    rep.add_argument('trace')
+    rep.add_argument('-c', '--config', required=True)
+    rep.add_argument('--i3status', default='./i3status')
+    rep.add_argument('--expect', help='compare with the output saved by --save')
+    rep.add_argument('--save', help='save the status lines to this file')
+    rep.set_defaults(func=replay)
+
+    args = parser.parse_args()
+    args.func(args)
+
+
+if __name__ == '__main__':
+    main()
@@ -31,7 +31,6 @@
 
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_version.h>
-#include <libnotify/notify.h>
 
 #include "i3status.h"
 
@@ -44,6 +43,9 @@
 
 #define CFG_CUSTOM_COLOR_OPTS CFG_COLOR_OPTS(NULL, NULL, NULL)
 
+/* Per-module update interval in seconds, 0 means the general interval. */
+#define CFG_INTERVAL_OPT CFG_FLOAT("interval", 0, CFGF_NONE)
+
 /* socket file descriptor for general purposes */
 int general_socket;
 
@@ -60,14 +62,16 @@ cfg_t *cfg, *cfg_general, *cfg_section;
  */
 void fatalsig(int signum) {
         exit_upon_signal = true;
+        events_wakeup();
 }
 
 /*
- * Do nothing upon SIGUSR1. Running this signal handler will nevertheless
- * interrupt nanosleep() so that i3status immediately generates new output.
+ * Upon SIGUSR1, wake up the main loop so that i3status immediately generates
+ * new output.
  *
  */
 void sigusr1(int signum) {
+        events_wakeup();
 }
 
 /*
@@ -193,6 +197,26 @@ static char *get_config_path(void) {
         return NULL;
 }
 
+/*
+ * Returns the config section of the given entry of the order list (like
+ * "battery 0"), or NULL if there is none.
+ *
+ */
+static cfg_t *block_section(cfg_opt_t *opts, const char *current) {
+        const char *title = strchr(current, ' ');
+        size_t len = (title != NULL ? (size_t)(title - current) : strlen(current));
+
+        for (cfg_opt_t *opt = opts; opt->name != NULL; opt++) {
+                if (opt->type != CFGT_SEC || strlen(opt->name) != len ||
+                    strncmp(opt->name, current, len) != 0)
+                        continue;
+                if (title == NULL)
+                        return cfg_getsec(cfg, opt->name);
+                return ((opt->flags & CFGF_TITLE) ? cfg_gettsec(cfg, opt->name, title + 1) : NULL);
+        }
+        return NULL;
+}
+
 int main(int argc, char *argv[]) {
         unsigned int j;
 
@@ -200,7 +224,11 @@ int main(int argc, char *argv[]) {
                 CFG_STR("output_format", "auto", CFGF_NONE),
                 CFG_BOOL("colors", 1, CFGF_NONE),
                 CFG_STR("color_separator", "#333333", CFGF_NONE),
-                CFG_INT("interval", 1, CFGF_NONE),
+                CFG_FLOAT("interval", 1, CFGF_NONE),
+                CFG_STR("notification_backend", "auto", CFGF_NONE),
+                CFG_STR("stats_socket", NULL, CFGF_NONE),
+                CFG_STR("fs_root", "", CFGF_NONE),
+                CFG_STR("json_emitter", "native", CFGF_NONE),
                 CFG_COLOR_OPTS("#00FF00", "#FFFF00", "#FF0000"),
                 CFG_END()
         };
@@ -210,6 +238,7 @@ int main(int argc, char *argv[]) {
                 CFG_STR("format_stopped", "Stopped", CFGF_NONE),
                 CFG_STR("notif_header_format", "%title", CFGF_NONE),
                 CFG_STR("notif_body_format", "%artist - %album", CFGF_NONE),
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -217,6 +246,7 @@ int main(int argc, char *argv[]) {
                 CFG_STR("pidfile", NULL, CFGF_NONE),
                 CFG_STR("format", "%title: %status", CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -224,6 +254,7 @@ int main(int argc, char *argv[]) {
                 CFG_STR("path", NULL, CFGF_NONE),
                 CFG_STR("format", "%title: %status", CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -231,6 +262,7 @@ int main(int argc, char *argv[]) {
                 CFG_STR("format_up", "W: (%quality at %essid, %bitrate) %ip", CFGF_NONE),
                 CFG_STR("format_down", "W: down", CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -238,6 +270,7 @@ int main(int argc, char *argv[]) {
                 CFG_STR("format_up", "E: %ip (%speed)", CFGF_NONE),
                 CFG_STR("format_down", "E: down", CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -245,6 +278,7 @@ int main(int argc, char *argv[]) {
                 CFG_STR("format_up", "%ip", CFGF_NONE),
                 CFG_STR("format_down", "no IPv6", CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -253,6 +287,7 @@ int main(int argc, char *argv[]) {
                 CFG_STR("format_down", "No battery", CFGF_NONE),
                 CFG_STR("notif_header_format", "Battery: %status", CFGF_NONE),
                 CFG_STR("notif_body_format", "%percentage, %remaining remaining", CFGF_NONE),
+                CFG_INT_LIST("notification_levels", "{}", CFGF_NONE),
                 CFG_STR("path", "/sys/class/power_supply/BAT%d/uevent", CFGF_NONE),
                 CFG_INT("low_threshold", 30, CFGF_NONE),
                 CFG_INT("critical_threshold", 10, CFGF_NONE),
@@ -260,34 +295,55 @@ int main(int argc, char *argv[]) {
                 CFG_BOOL("last_full_capacity", false, CFGF_NONE),
                 CFG_BOOL("integer_battery_capacity", false, CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
+                CFG_END()
+        };
+
+        cfg_opt_t power_opts[] = {
+                CFG_STR("format", "%source %capacity", CFGF_NONE),
+                CFG_STR("format_down", "no power supply", CFGF_NONE),
+                CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
         cfg_opt_t time_opts[] = {
                 CFG_STR("format", "%Y-%m-%d %H:%M:%S", CFGF_NONE),
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
         cfg_opt_t tztime_opts[] = {
                 CFG_STR("format", "%Y-%m-%d %H:%M:%S %Z", CFGF_NONE),
                 CFG_STR("timezone", "", CFGF_NONE),
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
         cfg_opt_t ddate_opts[] = {
                 CFG_STR("format", "%{%a, %b %d%}, %Y%N - %H", CFGF_NONE),
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
         cfg_opt_t load_opts[] = {
                 CFG_STR("format", "%1min %5min %15min", CFGF_NONE),
                 CFG_FLOAT("max_threshold", 5, CFGF_NONE),
+                CFG_BOOL("threshold_per_cpu", false, CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
         cfg_opt_t usage_opts[] = {
                 CFG_STR("format", "%usage", CFGF_NONE),
+                CFG_INTERVAL_OPT,
+                CFG_END()
+        };
+
+        cfg_opt_t cpu_freq_opts[] = {
+                CFG_STR("format", "%avg", CFGF_NONE),
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -296,12 +352,58 @@ int main(int argc, char *argv[]) {
                 CFG_STR("path", NULL, CFGF_NONE),
                 CFG_INT("max_threshold", 75, CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
+                CFG_END()
+        };
+
+        cfg_opt_t self_opts[] = {
+                CFG_STR("format", "%tick_ms ms %rss", CFGF_NONE),
+                CFG_STR("prefix_type", "binary", CFGF_NONE),
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
         cfg_opt_t disk_opts[] = {
                 CFG_STR("format", "%free", CFGF_NONE),
                 CFG_STR("prefix_type", "binary", CFGF_NONE),
+                CFG_INTERVAL_OPT,
+                CFG_END()
+        };
+
+        cfg_opt_t tunnel_opts[] = {
+                CFG_STR("format_up", "T: %ip", CFGF_NONE),
+                CFG_STR("format_down", "T: down", CFGF_NONE),
+                CFG_STR("prefix_type", "binary", CFGF_NONE),
+                CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
+                CFG_END()
+        };
+
+        cfg_opt_t disk_io_opts[] = {
+                CFG_STR("format", "%device: %read %write", CFGF_NONE),
+                CFG_STR("format_down", "%device: -", CFGF_NONE),
+                CFG_STR("prefix_type", "binary", CFGF_NONE),
+                CFG_INTERVAL_OPT,
+                CFG_END()
+        };
+
+        cfg_opt_t memory_opts[] = {
+                CFG_STR("format", "%used / %total", CFGF_NONE),
+                CFG_STR("prefix_type", "binary", CFGF_NONE),
+                CFG_STR("threshold_degraded", NULL, CFGF_NONE),
+                CFG_STR("threshold_critical", NULL, CFGF_NONE),
+                CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
+                CFG_END()
+        };
+
+        cfg_opt_t pressure_opts[] = {
+                CFG_STR("format", "%resource %avg10", CFGF_NONE),
+                CFG_STR("trigger", "some 150000 2000000", CFGF_NONE),
+                CFG_FLOAT("threshold_degraded", 10, CFGF_NONE),
+                CFG_FLOAT("threshold_critical", 40, CFGF_NONE),
+                CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -311,7 +413,9 @@ int main(int argc, char *argv[]) {
                 CFG_STR("device", "default", CFGF_NONE),
                 CFG_STR("mixer", "Master", CFGF_NONE),
                 CFG_INT("mixer_idx", 0, CFGF_NONE),
+                CFG_STR("capture_mixer", "Capture", CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
+                CFG_INTERVAL_OPT,
                 CFG_END()
         };
 
@@ -323,9 +427,12 @@ int main(int argc, char *argv[]) {
                 CFG_SEC("path_exists", path_exists_opts, CFGF_TITLE | CFGF_MULTI),
                 CFG_SEC("wireless", wireless_opts, CFGF_TITLE | CFGF_MULTI),
                 CFG_SEC("ethernet", ethernet_opts, CFGF_TITLE | CFGF_MULTI),
+                CFG_SEC("tunnel", tunnel_opts, CFGF_TITLE | CFGF_MULTI),
                 CFG_SEC("battery", battery_opts, CFGF_TITLE | CFGF_MULTI),
+                CFG_SEC("power", power_opts, CFGF_NONE),
                 CFG_SEC("cpu_temperature", temp_opts, CFGF_TITLE | CFGF_MULTI),
                 CFG_SEC("disk", disk_opts, CFGF_TITLE | CFGF_MULTI),
+                CFG_SEC("disk_io", disk_io_opts, CFGF_TITLE | CFGF_MULTI),
                 CFG_SEC("volume", volume_opts, CFGF_TITLE | CFGF_MULTI),
                 CFG_SEC("ipv6", ipv6_opts, CFGF_NONE),
                 CFG_SEC("time", time_opts, CFGF_NONE),
@@ -333,16 +440,24 @@ int main(int argc, char *argv[]) {
                 CFG_SEC("ddate", ddate_opts, CFGF_NONE),
                 CFG_SEC("load", load_opts, CFGF_NONE),
                 CFG_SEC("cpu_usage", usage_opts, CFGF_NONE),
+                CFG_SEC("cpu_freq", cpu_freq_opts, CFGF_NONE),
+                CFG_SEC("memory", memory_opts, CFGF_NONE),
+                CFG_SEC("pressure", pressure_opts, CFGF_TITLE | CFGF_MULTI),
+                CFG_SEC("self", self_opts, CFGF_NONE),
                 CFG_CUSTOM_COLOR_OPTS,
                 CFG_END()
         };
 
         char *configfile = NULL;
+        int bench_iterations = 0;
+        bool bench_json = false;
         int o, option_index = 0;
         struct option long_options[] = {
                 {"config", required_argument, 0, 'c'},
                 {"help", no_argument, 0, 'h'},
                 {"version", no_argument, 0, 'v'},
+                {"bench", required_argument, 0, 'b'},
+                {"json", no_argument, 0, 'j'},
                 {0, 0, 0, 0}
         };
 
@@ -370,11 +485,16 @@ int main(int argc, char *argv[]) {
                         configfile = optarg;
                 else if ((char)o == 'h') {
                         printf("i3status " VERSION " © 2008-2012 Michael Stapelberg and contributors\n"
-                                "Syntax: %s [-c <configfile>] [-h] [-v]\n", argv[0]);
+                                "Syntax: %s [-c <configfile>] [-h] [-v] [--bench <iterations> [--json]]\n", argv[0]);
                         return 0;
                 } else if ((char)o == 'v') {
                         printf("i3status " VERSION " © 2008-2012 Michael Stapelberg and contributors\n");
                         return 0;
+                } else if ((char)o == 'b') {
+                        if ((bench_iterations = atoi(optarg)) <= 0)
+                                die("The number of benchmark iterations must be positive\n");
+                } else if ((char)o == 'j') {
+                        bench_json = true;
                 }
 
 
@@ -393,6 +513,10 @@ int main(int argc, char *argv[]) {
                 die("Could not get section \"general\"\n");
 
         char *output_str = cfg_getstr(cfg_general, "output_format");
+        /* In benchmark mode, output is generated but never printed, so
+         * there is no need to detect the format. */
+        if (bench_iterations > 0 && strcasecmp(output_str, "auto") == 0)
+                output_str = "i3bar";
         if (strcasecmp(output_str, "auto") == 0) {
                 fprintf(stderr, "i3status: trying to auto-detect output_format setting\n");
                 output_str = auto_detect_format();
@@ -422,6 +546,11 @@ int main(int argc, char *argv[]) {
                         || !valid_color(cfg_getstr(cfg_general, "color_separator")))
                die("Bad color format");
 
+        init_colors();
+
+        if (!set_json_emitter(cfg_getstr(cfg_general, "json_emitter")))
+                die("Unknown json_emitter: \"%s\"\n", cfg_getstr(cfg_general, "json_emitter"));
+
 #if YAJL_MAJOR >= 2
         yajl_gen json_gen = yajl_gen_alloc(NULL);
 #else
@@ -431,25 +560,86 @@ int main(int argc, char *argv[]) {
         if (output_format == O_I3BAR) {
                 /* Initialize the i3bar protocol. See i3/docs/i3bar-protocol
                  * for details. */
-                printf("{\"version\":1}\n[\n");
-                fflush(stdout);
+                if (bench_iterations == 0) {
+                        printf("{\"version\":1}\n[\n");
+                        fflush(stdout);
+                }
+                /* The yajl emitter generates the blocks as elements of this
+                 * (never closed) array. The commas it adds between them are
+                 * stripped, see i3bar_block_close(). */
                 yajl_gen_array_open(json_gen);
                 yajl_gen_clear(json_gen);
         }
-        if (output_format == O_TERM) {
+        if (output_format == O_TERM && bench_iterations == 0) {
                 /* Save the cursor-position and hide the cursor */
                 printf("\033[s\033[?25l");
+                fflush(stdout);
                 /* Undo at exit */
                 atexit(&reset_cursor);
         }
 
+        if (!set_notification_backend(cfg_getstr(cfg_general, "notification_backend")))
+                die("Unknown or unsupported notification_backend: \"%s\"\n", cfg_getstr(cfg_general, "notification_backend"));
+
         if ((general_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1)
                 die("Could not create socket\n");
 
-        // Initialize libnotify
-        notify_init("i3status");
+        set_fs_root(cfg_getstr(cfg_general, "fs_root"));
 
-        int interval = cfg_getint(cfg_general, "interval");
+        events_init();
+        stats_init(cfg_size(cfg, "order"));
+        if (cfg_getstr(cfg_general, "stats_socket") != NULL && bench_iterations == 0)
+                stats_listen(cfg_getstr(cfg_general, "stats_socket"));
+
+        double interval = cfg_getfloat(cfg_general, "interval");
+        if (interval <= 0)
+                die("The interval must be positive\n");
+
+        for (unsigned int i = 0; i < cfg_size(cfg, "battery"); i++) {
+                cfg_t *sec = cfg_getnsec(cfg, "battery", i);
+                if (cfg_size(sec, "notification_levels") > MAX_NOTIFICATION_LEVELS)
+                        die("battery %s: at most %d notification_levels are supported\n", cfg_title(sec), MAX_NOTIFICATION_LEVELS);
+        }
+
+        /* Every block has its own update interval in milliseconds. Updates
+         * happen on multiples of the interval (since the epoch), so that
+         * e.g. an interval of 5 seconds updates at :00, :05 and so on, and
+         * blocks with the same interval are updated together. The wall clock
+         * is only used for this alignment, the due times are kept on the
+         * monotonic clock so that setting the clock does not stall updates. */
+        unsigned int num_blocks = cfg_size(cfg, "order");
+        long long *block_interval = scalloc(num_blocks * sizeof(long long));
+        long long *block_due = scalloc(num_blocks * sizeof(long long));
+        /* The output of time blocks only changes when their format’s
+         * granularity boundary is crossed (e.g. the next minute for "%H:%M"),
+         * so they are not updated before that. -1 for all other blocks. */
+        int *block_granularity = scalloc(num_blocks * sizeof(int));
+        const char **block_timezone = scalloc(num_blocks * sizeof(const char *));
+        for (j = 0; j < num_blocks; j++) {
+                const char *current = cfg_getnstr(cfg, "order", j);
+                cfg_t *sec = block_section(opts, current);
+                double block_seconds = (sec != NULL && cfg_getfloat(sec, "interval") > 0 ? cfg_getfloat(sec, "interval") : interval);
+                block_interval[j] = max((long long)(block_seconds * 1000 + 0.5), 1);
+
+                block_granularity[j] = -1;
+                if (sec == NULL)
+                        continue;
+                if (BEGINS_WITH(current, "ddate")) {
+                        block_granularity[j] = GRANULARITY_DAY;
+                } else if (BEGINS_WITH(current, "time")) {
+                        block_granularity[j] = time_format_granularity(cfg_getstr(sec, "format"));
+                } else if (BEGINS_WITH(current, "tztime")) {
+                        block_granularity[j] = time_format_granularity(cfg_getstr(sec, "format"));
+                        block_timezone[j] = cfg_getstr(sec, "timezone");
+                }
+        }
+        output_init_blocks(num_blocks);
+        events_init_blocks(num_blocks);
+        bool refresh = false;
+        long long next_due = 0;
+        /* The difference between the wall clock and the monotonic clock, to
+         * notice when the wall clock is set. */
+        long long clock_offset = 0;
 
         /* One memory page which each plugin can use to buffer output.
          * Even though it’s unclean, we just assume that the user will not
@@ -459,26 +649,69 @@ int main(int argc, char *argv[]) {
          * (!), not individual plugins, seem very unlikely. */
         char buffer[4096];
 
+        if (bench_iterations > 0)
+                bench_init(cfg_size(cfg, "order"), bench_iterations);
+        int iteration = 0;
+
         while (1) {
                 if (exit_upon_signal) {
                         fprintf(stderr, "Exiting due to signal.\n");
                         cleanup_mpd();
-                        notify_uninit();
+                        stop_notifications();
                         exit(1);
                 }
                 struct timeval tv;
                 gettimeofday(&tv, NULL);
-                if (output_format == O_I3BAR)
-                        yajl_gen_array_open(json_gen);
-                else if (output_format == O_TERM)
-                        /* Restore the cursor-position, clear line */
-                        printf("\033[u\033[K");
-                for (j = 0; j < cfg_size(cfg, "order"); j++) {
+                long long now = events_monotonic_ms();
+                long long wall = tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+
+                /* When the wall clock was set (e.g. by NTP), the time blocks
+                 * are outdated and the alignment of all blocks is off. */
+                if (llabs(wall - now - clock_offset) > 1000) {
+                        for (j = 0; j < num_blocks; j++)
+                                block_due[j] = (block_granularity[j] != -1 ? now : min(block_due[j], now + block_interval[j]));
+                        next_due = now;
+                }
+                clock_offset = wall - now;
+
+                /* Sleep until the next block is due, but at most for the
+                 * interval so that the wall clock is checked regularly.
+                 * SIGUSR1 updates all blocks right away, a module noticing a
+                 * change only the blocks depending on it. */
+                if (!refresh && now < next_due) {
+                        long long wait = min(next_due - now, (long long)(interval * 1000 + 0.5));
+                        struct timespec ts = {wait / 1000, (wait % 1000) * 1000000};
+                        refresh = events_wait(&ts);
+                        continue;
+                }
+
+                if (bench_iterations > 0)
+                        bench_tick_start();
+                stats_tick_start();
+                output_line_start();
+                for (j = 0; j < num_blocks; j++) {
                         if (j > 0)
                                 print_seperator();
 
                         const char *current = cfg_getnstr(cfg, "order", j);
 
+                        if (!events_refresh_due(j) && now < block_due[j]) {
+                                output_block_cached(j);
+                                continue;
+                        }
+                        /* Updates which were missed because the previous
+                         * tick took too long are skipped, not caught up. */
+                        long long due = (wall / block_interval[j] + 1) * block_interval[j];
+                        if (block_granularity[j] != -1)
+                                due = max(due, time_next_boundary(tv.tv_sec, block_granularity[j], block_timezone[j]) * 1000LL);
+                        block_due[j] = now + (due - wall);
+
+                        output_block_begin();
+                        if (bench_iterations > 0)
+                                bench_block_start();
+                        stats_block_start(j, current);
+                        events_set_block(j);
+
                         CASE_SEC("mpd") {
                                 SEC_OPEN_MAP("mpd");
                                 print_mpd(json_gen, buffer,
@@ -507,7 +740,18 @@ int main(int argc, char *argv[]) {
                                 SEC_CLOSE_MAP;
                         }
 
+                        CASE_SEC_TITLE("tunnel") {
+                                SEC_OPEN_MAP("tunnel");
+                                print_tunnel(json_gen, buffer, title, cfg_getstr(sec, "format_up"), cfg_getstr(sec, "format_down"), cfg_getstr(sec, "prefix_type"));
+                                SEC_CLOSE_MAP;
+                        }
+
                         CASE_SEC_TITLE("battery") {
+                                int levels[MAX_NOTIFICATION_LEVELS];
+                                int num_levels = 0;
+                                for (unsigned int l = 0; l < cfg_size(sec, "notification_levels"); l++)
+                                        levels[num_levels++] = cfg_getnint(sec, "notification_levels", l);
+
                                 SEC_OPEN_MAP("battery");
                                 print_battery_info(json_gen, buffer, atoi(title),
                                         cfg_getstr(sec, "path"),
@@ -515,6 +759,7 @@ int main(int argc, char *argv[]) {
                                         cfg_getstr(sec, "format_down"),
                                         cfg_getstr(sec, "notif_header_format"),
                                         cfg_getstr(sec, "notif_body_format"),
+                                        levels, num_levels,
                                         cfg_getint(sec, "low_threshold"),
                                         cfg_getstr(sec, "threshold_type"),
                                         cfg_getbool(sec, "last_full_capacity"),
@@ -522,6 +767,12 @@ int main(int argc, char *argv[]) {
                                 SEC_CLOSE_MAP;
                         }
 
+                        CASE_SEC("power") {
+                                SEC_OPEN_MAP("power");
+                                print_power(json_gen, buffer, cfg_getstr(sec, "format"), cfg_getstr(sec, "format_down"));
+                                SEC_CLOSE_MAP;
+                        }
+
                         CASE_SEC_TITLE("run_watch") {
                                 SEC_OPEN_MAP("run_watch");
                                 print_run_watch(json_gen, buffer, title, cfg_getstr(sec, "pidfile"), cfg_getstr(sec, "format"));
@@ -540,9 +791,15 @@ int main(int argc, char *argv[]) {
                                 SEC_CLOSE_MAP;
                         }
 
+                        CASE_SEC_TITLE("disk_io") {
+                                SEC_OPEN_MAP("disk_io");
+                                print_disk_io(json_gen, buffer, title, cfg_getstr(sec, "format"), cfg_getstr(sec, "format_down"), cfg_getstr(sec, "prefix_type"));
+                                SEC_CLOSE_MAP;
+                        }
+
                         CASE_SEC("load") {
                                 SEC_OPEN_MAP("load");
-                                print_load(json_gen, buffer, cfg_getstr(sec, "format"), cfg_getfloat(sec, "max_threshold"));
+                                print_load(json_gen, buffer, cfg_getstr(sec, "format"), cfg_getfloat(sec, "max_threshold"), cfg_getbool(sec, "threshold_per_cpu"));
                                 SEC_CLOSE_MAP;
                         }
 
@@ -570,7 +827,8 @@ int main(int argc, char *argv[]) {
                                              cfg_getstr(sec, "format_muted"),
                                              cfg_getstr(sec, "device"),
                                              cfg_getstr(sec, "mixer"),
-                                             cfg_getint(sec, "mixer_idx"));
+                                             cfg_getint(sec, "mixer_idx"),
+                                             cfg_getstr(sec, "capture_mixer"));
                                 SEC_CLOSE_MAP;
                         }
 
@@ -585,34 +843,63 @@ int main(int argc, char *argv[]) {
                                 print_cpu_usage(json_gen, buffer, cfg_getstr(sec, "format"));
                                 SEC_CLOSE_MAP;
                         }
+
+                        CASE_SEC("cpu_freq") {
+                                SEC_OPEN_MAP("cpu_freq");
+                                print_cpu_freq(json_gen, buffer, cfg_getstr(sec, "format"));
+                                SEC_CLOSE_MAP;
+                        }
+
+                        CASE_SEC("memory") {
+                                SEC_OPEN_MAP("memory");
+                                print_memory(json_gen, buffer, cfg_getstr(sec, "format"), cfg_getstr(sec, "prefix_type"), cfg_getstr(sec, "threshold_degraded"), cfg_getstr(sec, "threshold_critical"));
+                                SEC_CLOSE_MAP;
+                        }
+
+                        CASE_SEC_TITLE("pressure") {
+                                SEC_OPEN_MAP("pressure");
+                                print_pressure(json_gen, buffer, title, cfg_getstr(sec, "format"), cfg_getstr(sec, "trigger"), cfg_getfloat(sec, "threshold_degraded"), cfg_getfloat(sec, "threshold_critical"));
+                                SEC_CLOSE_MAP;
+                        }
+
+                        CASE_SEC("self") {
+                                SEC_OPEN_MAP("self");
+                                print_self(json_gen, buffer, cfg_getstr(sec, "format"), cfg_getstr(sec, "prefix_type"));
+                                SEC_CLOSE_MAP;
+                        }
+
+                        events_set_block(-1);
+                        stats_block_end();
+                        if (bench_iterations > 0)
+                                bench_block_end(j, current);
+                        output_block_end(j);
                 }
-                if (output_format == O_I3BAR) {
-                        yajl_gen_array_close(json_gen);
-                        const unsigned char *buf;
-#if YAJL_MAJOR >= 2
-                        size_t len;
-#else
-                        unsigned int len;
-#endif
-                        yajl_gen_get_buf(json_gen, &buf, &len);
-                        write(STDOUT_FILENO, buf, len);
-                        yajl_gen_clear(json_gen);
+                output_line_end(bench_iterations == 0);
+                stats_tick_end();
+
+                if (bench_iterations > 0) {
+                        bench_tick_end();
+                        if (++iteration < bench_iterations) {
+                                events_request_refresh(NULL);
+                                continue;
+                        }
+                        bench_report(bench_json);
+                        cleanup_mpd();
+                        stop_notifications();
+                        return 0;
                 }
 
-                printf("\n");
-                fflush(stdout);
+                refresh = false;
+                next_due = block_due[0];
+                for (j = 1; j < num_blocks; j++)
+                        next_due = (block_due[j] < next_due ? block_due[j] : next_due);
 
-                /* To provide updates on every full second (as good as possible)
-                 * we don’t use sleep(interval) but we sleep until the next
-                 * second (with microsecond precision) plus (interval-1)
-                 * seconds. We also align to 60 seconds modulo interval such
-                 * that we start with :00 on every new minute. */
-                struct timeval current_timeval;
-                gettimeofday(&current_timeval, NULL);
-                struct timespec ts = {interval - 1 - (current_timeval.tv_sec % interval), (10e5 - current_timeval.tv_usec) * 1000};
-                nanosleep(&ts, NULL);
+                /* If rendering took longer than the time until the next
+                 * update, the next tick starts right away. */
+                if (events_monotonic_ms() >= next_due)
+                        stats_overrun();
         }
 
         cleanup_mpd();
-        notify_uninit();
+        stop_notifications();
 }
@@ -10,9 +10,13 @@ enum { O_DZEN2, O_XMOBAR, O_I3BAR, O_TERM, O_NONE } output_format;
 #include <yajl/yajl_version.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <glob.h>
+#include <netinet/in.h>
 
 #define BEGINS_WITH(haystack, needle) (strncmp(haystack, needle, strlen(needle)) == 0)
 #define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 #if defined(LINUX)
 
@@ -62,33 +66,31 @@ enum { O_DZEN2, O_XMOBAR, O_I3BAR, O_TERM, O_NONE } output_format;
                                 if (sec != NULL)
 
 /* Macro which any plugin can use to output the full_text part (when the output
- * format is JSON) or just output to stdout (any other output format). */
+ * format is JSON) or just append it to the status line (any other output
+ * format). */
 #define OUTPUT_FULL_TEXT(text) \
 	do { \
 		/* Terminate the output buffer here in any case, so that it’s \
 		 * not forgotten in the module */ \
 		*outwalk = '\0'; \
 		if (output_format == O_I3BAR) { \
-			yajl_gen_string(json_gen, (const unsigned char *)"full_text", strlen("full_text")); \
-			yajl_gen_string(json_gen, (const unsigned char *)text, strlen(text)); \
+			i3bar_string(json_gen, KEY_FULL_TEXT, text); \
 		} else { \
-			printf("%s", text); \
+			output_text(text); \
 		} \
 	} while (0)
 
 #define SEC_OPEN_MAP(name) \
 	do { \
 		if (output_format == O_I3BAR) { \
-			yajl_gen_map_open(json_gen); \
-			yajl_gen_string(json_gen, (const unsigned char *)"name", strlen("name")); \
-			yajl_gen_string(json_gen, (const unsigned char *)name, strlen(name)); \
+			i3bar_block_open(json_gen, name); \
 		} \
 	} while (0)
 
 #define SEC_CLOSE_MAP \
 	do { \
 		if (output_format == O_I3BAR) { \
-			yajl_gen_map_close(json_gen); \
+			i3bar_block_close(json_gen); \
 		} \
 	} while (0)
 
@@ -101,8 +103,7 @@ enum { O_DZEN2, O_XMOBAR, O_I3BAR, O_TERM, O_NONE } output_format;
 			if (!_val) \
 				_val = cfg_getstr(cfg_general, colorstr); \
 			if (output_format == O_I3BAR) { \
-				yajl_gen_string(json_gen, (const unsigned char *)"color", strlen("color")); \
-				yajl_gen_string(json_gen, (const unsigned char *)_val, strlen(_val)); \
+				i3bar_string(json_gen, KEY_COLOR, _val); \
 			} else { \
 				outwalk += sprintf(outwalk, "%s", color(colorstr)); \
 			} \
@@ -119,8 +120,7 @@ enum { O_DZEN2, O_XMOBAR, O_I3BAR, O_TERM, O_NONE } output_format;
 #define INSTANCE(instance) \
 	do { \
 		if (output_format == O_I3BAR) { \
-			yajl_gen_string(json_gen, (const unsigned char *)"instance", strlen("instance")); \
-			yajl_gen_string(json_gen, (const unsigned char *)instance, strlen(instance)); \
+			i3bar_string(json_gen, KEY_INSTANCE, instance); \
 		} \
 	} while (0)
 
@@ -131,34 +131,154 @@ typedef enum { CS_DISCHARGING, CS_CHARGING, CS_FULL } charging_status_t;
 char *skip_character(char *input, char character, int amount);
 void die(const char *fmt, ...);
 bool slurp(const char *filename, char *destination, int size);
+void set_fs_root(const char *root);
+const char *root_path(const char *path, char *buf, size_t size);
+int open_rooted(const char *path, int flags);
+int glob_rooted(const char *pattern, int flags, glob_t *pglob);
 
 /* src/output.c */
+enum i3bar_key { KEY_NAME, KEY_INSTANCE, KEY_FULL_TEXT, KEY_COLOR };
+bool set_json_emitter(const char *name);
+void output_line_start(void);
+void output_line_end(bool flush);
+size_t output_line_len(void);
+void output_init_blocks(unsigned int num_blocks);
+void output_block_begin(void);
+void output_block_end(unsigned int block);
+void output_block_cached(unsigned int block);
+void output_text(const char *text);
+void i3bar_block_open(yajl_gen json_gen, const char *name);
+void i3bar_block_close(yajl_gen json_gen);
+void i3bar_string(yajl_gen json_gen, enum i3bar_key key, const char *value);
+void init_colors(void);
 void print_seperator();
-char *color(const char *colorstr);
+const char *color(const char *colorstr);
 char *endcolor() __attribute__ ((pure));
 void reset_cursor(void);
 
+/* src/events.c */
+typedef void (*event_cb)(int fd, short revents, void *data);
+void events_init(void);
+void events_wakeup(void);
+void events_add(int fd, short events, event_cb cb, void *data);
+void events_remove(int fd);
+void events_init_blocks(unsigned int blocks);
+void events_set_block(int block);
+void events_depend(const void *source);
+void events_request_refresh(const void *source);
+bool events_refresh_due(unsigned int block);
+bool events_wait(const struct timespec *timeout);
+long long events_monotonic_ms(void);
+double events_monotonic_seconds(void);
+
+/* src/uevent.c */
+struct uevent {
+        const char *action;
+        const char *devpath;
+        const char *subsystem;
+        /* The raw message: NUL-separated KEY=value pairs. */
+        const char *buf;
+        size_t len;
+};
+typedef void (*uevent_cb)(const struct uevent *event, void *data);
+bool uevent_subscribe(const char *subsystem, uevent_cb cb, void *data);
+const char *uevent_get(const struct uevent *event, const char *key);
+
+/* src/ifstate.c */
+unsigned long ifstate_generation(void);
+
+/* src/stats.c */
+void stats_init(unsigned int blocks_in_order);
+void stats_tick_start(void);
+void stats_tick_end(void);
+void stats_overrun(void);
+unsigned long stats_overruns(void);
+unsigned long stats_ticks(void);
+void stats_block_start(unsigned int block, const char *name);
+void stats_block_end(void);
+void stats_error(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+double stats_last_tick_ms(void);
+unsigned long stats_total_errors(void);
+unsigned int stats_stale_blocks(void);
+unsigned long long stats_rss(void);
+void stats_listen(const char *path);
+
+/* src/bench.c */
+void bench_init(unsigned int blocks_in_order, int num_iterations);
+void bench_tick_start(void);
+void bench_tick_end(void);
+void bench_block_start(void);
+void bench_block_end(unsigned int block, const char *name);
+void bench_report(bool json);
+
 /* src/auto_detect_format.c */
 char *auto_detect_format();
 
+/* src/notifications.c */
+bool set_notification_backend(const char *name);
+void send_notification(const char *source, const char *summary, const char *body, bool critical);
+void stop_notifications(void);
+
+/* src/dbus_notify.c */
+bool dbus_send_notification(const char *app_name, const char *summary, const char *body, bool critical);
+void dbus_disconnect(void);
+
+/* src/pulse.c */
+bool pulse_volume(const char *sink, int *volume, bool *muted);
+
 /* src/print_time.c */
+enum time_granularity { GRANULARITY_SECOND, GRANULARITY_MINUTE, GRANULARITY_HOUR, GRANULARITY_DAY };
 void set_timezone(const char *tz);
+enum time_granularity time_format_granularity(const char *format);
+time_t time_next_boundary(time_t t, enum time_granularity granularity, const char *tz);
 
 void print_ipv6_info(yajl_gen json_gen, char *buffer, const char *format_up, const char *format_down);
 void print_disk_info(yajl_gen json_gen, char *buffer, const char *path, const char *format, const char *prefix_type);
-void print_battery_info(yajl_gen json_gen, char *buffer, int number, const char *path, const char *format, const char *format_down, const char *notif_header_format, const char *notif_body_format, int low_threshold, char *threshold_type, bool last_full_capacity, bool integer_battery_capacity);
+int print_bytes_human(char *outwalk, uint64_t bytes, const char *prefix_type);
+#define MAX_NOTIFICATION_LEVELS 8
+void print_battery_info(yajl_gen json_gen, char *buffer, int number, const char *path, const char *format, const char *format_down, const char *notif_header_format, const char *notif_body_format, const int *notification_levels, int num_notification_levels, int low_threshold, char *threshold_type, bool last_full_capacity, bool integer_battery_capacity);
+void print_power(yajl_gen json_gen, char *buffer, const char *format, const char *format_down);
 void print_time(yajl_gen json_gen, char *buffer, const char *format, const char *tz, time_t t);
 void print_ddate(yajl_gen json_gen, char *buffer, const char *format, time_t t);
-const char *get_ip_addr();
+
+/* src/print_ip_addr.c */
+#define MAX_IF_ADDRS 16
+struct ip_addr {
+        int family;
+        int prefix;
+        bool link_local;
+        union {
+                struct in_addr v4;
+                struct in6_addr v6;
+        } addr;
+};
+struct if_addrs {
+        /* IFNAMSIZ, without pulling in <net/if.h>, which conflicts with
+         * <linux/if.h> used by iwlib. */
+        char name[16];
+        unsigned int flags;
+        int num_addrs;
+        struct ip_addr addrs[MAX_IF_ADDRS];
+};
+const struct if_addrs *get_if_addrs(const char *interface);
+int print_ip_addr(char *outwalk, const struct if_addrs *ifa, bool cidr);
+int print_ip_addrs(char *outwalk, const struct if_addrs *ifa, int family);
+
 void print_wireless_info(yajl_gen json_gen, char *buffer, const char *interface, const char *format_up, const char *format_down);
 void print_run_watch(yajl_gen json_gen, char *buffer, const char *title, const char *pidfile, const char *format);
 void print_path_exists(yajl_gen json_gen, char *buffer, const char *title, const char *path, const char *format);
 void print_cpu_temperature_info(yajl_gen json_gen, char *buffer, int zone, const char *path, const char *format, int);
 void print_cpu_usage(yajl_gen json_gen, char *buffer, const char *format);
+void print_cpu_freq(yajl_gen json_gen, char *buffer, const char *format);
+void print_pressure(yajl_gen json_gen, char *buffer, const char *resource, const char *format, const char *trigger, double threshold_degraded, double threshold_critical);
+void print_tunnel(yajl_gen json_gen, char *buffer, const char *interface, const char *format_up, const char *format_down, const char *prefix_type);
+void print_disk_io(yajl_gen json_gen, char *buffer, const char *device_name, const char *format, const char *format_down, const char *prefix_type);
+void print_memory(yajl_gen json_gen, char *buffer, const char *format, const char *prefix_type, const char *threshold_degraded, const char *threshold_critical);
+void print_self(yajl_gen json_gen, char *buffer, const char *format, const char *prefix_type);
 void print_eth_info(yajl_gen json_gen, char *buffer, const char *interface, const char *format_up, const char *format_down);
-void print_load(yajl_gen json_gen, char *buffer, const char *format, const float max_threshold);
+void print_load(yajl_gen json_gen, char *buffer, const char *format, const float max_threshold, bool threshold_per_cpu);
 void print_mpd(yajl_gen json_gen, char *buffer, const char *format, const char *format_stopped, const char *notif_header_format, const char *notif_body_format);
-void print_volume(yajl_gen json_gen, char *buffer, const char *fmt, const char *fmt_muted, const char *device, const char *mixer, int mixer_idx);
+void print_volume(yajl_gen json_gen, char *buffer, const char *fmt, const char *fmt_muted, const char *device, const char *mixer, int mixer_idx, const char *capture_mixer);
 void cleanup_mpd();
 bool process_runs(const char *path);
 
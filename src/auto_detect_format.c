@@ -54,22 +54,269 @@ static char *format_for_process(const char *name) {
         return NULL;
 }
 
+/*
+ * Returns the static format string for the given (user-supplied) name, or
+ * NULL if it is not a known output format.
+ *
+ */
+static char *known_format(const char *name) {
+    static char *formats[] = {"i3bar", "dzen2", "xmobar", "term", "none"};
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+        if (strcasecmp(name, formats[i]) == 0)
+            return formats[i];
+    return NULL;
+}
+
+/*
+ * Reads the name of the given process, which must be a child of parentpid.
+ * To avoid the possible race condition of the process existing already but
+ * not executing the destination (shell after fork() and before exec()), we
+ * check if the name equals the name of its parent.
+ *
+ * We try this for up to 0.5 seconds, then we give up.
+ *
+ */
+static char *child_name(pid_t pid, pid_t parentpid, const char *parentname) {
+    char *name = NULL;
+    pid_t ppid;
+    int loopcnt = 0;
+
+    do {
+        /* give the scheduler a chance between each iteration, don’t hog
+         * the CPU too much */
+        if (name) {
+            usleep(50);
+            free(name);
+            name = NULL;
+        }
+
+        if (!parse_proc_stat(pid, &name, &ppid))
+            return NULL;
+        if (ppid != parentpid) {
+            free(name);
+            return NULL;
+        }
+    } while (strcmp(parentname, name) == 0 && loopcnt++ < 10000);
+
+    return name;
+}
+
+/*
+ * Fast path: if stdout is a pipe, find the sibling process which has the
+ * other end of that pipe as its stdin. Only our parent’s children (from
+ * /proc/<ppid>/task/<tid>/children) are looked at, so the cost does not
+ * depend on the number of processes on the system.
+ *
+ * Returns NULL if the format could not be determined this way, e.g. because
+ * the kernel does not provide the children file.
+ *
+ */
+static char *format_from_stdout_pipe(pid_t myppid, pid_t mypid, const char *parentname) {
+    struct stat st;
+    char path[255];
+    char pipename[64];
+    char target[64];
+    char buffer[4096];
+    DIR *dir;
+    struct dirent *entry;
+    char *format = NULL;
+
+    if (fstat(STDOUT_FILENO, &st) == -1 || !S_ISFIFO(st.st_mode))
+        return NULL;
+    (void)snprintf(pipename, sizeof(pipename), "pipe:[%lu]", (unsigned long)st.st_ino);
+
+    (void)snprintf(path, sizeof(path), "/proc/%d/task", myppid);
+    if (!(dir = opendir(path)))
+        return NULL;
+
+    while (format == NULL && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        if (snprintf(path, sizeof(path), "/proc/%d/task/%s/children", myppid, entry->d_name) == -1 ||
+            !slurp(path, buffer, sizeof(buffer)))
+            continue;
+
+        for (char *walk = buffer; *walk != '\0';) {
+            char *end;
+            pid_t pid = (pid_t)strtol(walk, &end, 10);
+            if (end == walk)
+                break;
+            walk = end;
+
+            if (pid == mypid)
+                continue;
+
+            (void)snprintf(path, sizeof(path), "/proc/%d/fd/0", pid);
+            ssize_t len = readlink(path, target, sizeof(target) - 1);
+            if (len == -1)
+                continue;
+            target[len] = '\0';
+            if (strcmp(target, pipename) != 0)
+                continue;
+
+            char *name = child_name(pid, myppid, parentname);
+            if (name == NULL)
+                continue;
+            format = format_for_process(name);
+            free(name);
+            break;
+        }
+    }
+
+    closedir(dir);
+    return format;
+}
+
+/*
+ * Returns the path of the file which caches detected formats, keyed by the
+ * command line of our parent process.
+ *
+ */
+static char *cache_path(void) {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char *path;
+
+    if (cache_home != NULL && *cache_home != '\0') {
+        if (asprintf(&path, "%s/i3status-format-cache", cache_home) == -1)
+            return NULL;
+    } else if (home != NULL) {
+        if (asprintf(&path, "%s/.cache/i3status-format-cache", home) == -1)
+            return NULL;
+    } else return NULL;
+
+    return path;
+}
+
+/*
+ * Reads the command line of the given process, with the arguments separated
+ * by spaces instead of NUL bytes.
+ *
+ */
+static bool read_cmdline(pid_t pid, char *cmdline, int size) {
+    char path[255];
+    int fd, n;
+
+    (void)snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return false;
+    n = read(fd, cmdline, size - 1);
+    (void)close(fd);
+    if (n <= 0)
+        return false;
+
+    /* strip the trailing NUL and separate arguments by space */
+    if (cmdline[n - 1] == '\0')
+        n--;
+    cmdline[n] = '\0';
+    for (int i = 0; i < n; i++)
+        if (cmdline[i] == '\0' || cmdline[i] == '\n' || cmdline[i] == '\t')
+            cmdline[i] = ' ';
+    return true;
+}
+
+/*
+ * Looks up the format which was detected for the given parent command line
+ * the last time. Each line of the cache file is "<format>\t<cmdline>".
+ *
+ */
+static char *cached_format(const char *cmdline) {
+    char *path = cache_path();
+    char line[4096 + 64];
+    char *format = NULL;
+    FILE *file;
+
+    if (path == NULL || (file = fopen(path, "r")) == NULL) {
+        free(path);
+        return NULL;
+    }
+
+    while (format == NULL && fgets(line, sizeof(line), file) != NULL) {
+        char *tab = strchr(line, '\t');
+        if (tab == NULL)
+            continue;
+        *tab = '\0';
+        tab[strcspn(tab + 1, "\n") + 1] = '\0';
+        if (strcmp(tab + 1, cmdline) == 0)
+            format = known_format(line);
+    }
+
+    fclose(file);
+    free(path);
+    return format;
+}
+
+/*
+ * Remembers the detected format for the given parent command line. The
+ * entry for that command line (if any) is replaced.
+ *
+ */
+static void cache_format(const char *cmdline, const char *format) {
+    char *path = cache_path();
+    char *tmppath = NULL;
+    char line[4096 + 64];
+    FILE *in, *out;
+
+    if (path == NULL || asprintf(&tmppath, "%s.%d", path, getpid()) == -1 ||
+        (out = fopen(tmppath, "w")) == NULL)
+        goto out;
+
+    if ((in = fopen(path, "r")) != NULL) {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            char *tab = strchr(line, '\t');
+            if (tab == NULL)
+                continue;
+            tab[strcspn(tab + 1, "\n") + 1] = '\0';
+            if (strcmp(tab + 1, cmdline) == 0)
+                continue;
+            fprintf(out, "%s\n", line);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s\t%s\n", format, cmdline);
+
+    if (fclose(out) != 0 || rename(tmppath, path) == -1)
+        (void)unlink(tmppath);
+
+out:
+    free(tmppath);
+    free(path);
+}
+
 /*
  * This function tries to automatically find out where i3status is being piped
  * to and choses the appropriate output format.
  *
  * It is a little hackish but should work for most setups :).
  *
- * By iterating through /proc/<number>/stat and finding out the parent process
- * id (just like pstree(1) or ps(1) work), we can get all children of our
- * parent. When the output of i3status is being piped somewhere, the shell
- * (parent process) spawns i3status and the destination process, so we will
- * find our own process and the pipe target.
+ * The detection tries the cheap methods first:
+ *
+ * 1. The I3STATUS_OUTPUT_FORMAT environment variable, if set.
+ * 2. Whether stdout is a terminal.
+ * 3. The name of our parent process (some shells make the pipe target the
+ *    parent of i3status).
+ * 4. The sibling process reading from our stdout pipe.
+ * 5. The format detected last time for the same parent command line.
+ *
+ * Only if all of these fail, we iterate through /proc/<number>/stat and find
+ * out the parent process id (just like pstree(1) or ps(1) work), so that we
+ * get all children of our parent. When the output of i3status is being piped
+ * somewhere, the shell (parent process) spawns i3status and the destination
+ * process, so we will find our own process and the pipe target.
  *
  * We then check whether the pipe target’s name is known and chose the format.
  *
  */
 char *auto_detect_format(void) {
+    char *override = getenv("I3STATUS_OUTPUT_FORMAT");
+    if (override != NULL && *override != '\0') {
+        char *format = known_format(override);
+        if (format != NULL)
+            return format;
+        fprintf(stderr, "i3status: ignoring unknown I3STATUS_OUTPUT_FORMAT \"%s\"\n", override);
+    }
+
     /* If stdout is a tty, we output directly to a terminal. */
     if (isatty(STDOUT_FILENO)) {
         return "term";
@@ -86,6 +333,9 @@ char *auto_detect_format(void) {
     char *parentname;
     pid_t parentpid;
 
+    char cmdline[4096];
+    bool have_cmdline = false;
+
     if (!parse_proc_stat(myppid, &parentname, &parentpid))
         return NULL;
 
@@ -103,6 +353,14 @@ char *auto_detect_format(void) {
     if ((format = format_for_process(parentname)) != NULL)
         goto out;
 
+    have_cmdline = read_cmdline(myppid, cmdline, sizeof(cmdline));
+
+    if ((format = format_from_stdout_pipe(myppid, mypid, parentname)) != NULL)
+        goto cache;
+
+    if (have_cmdline && (format = cached_format(cmdline)) != NULL)
+        goto out;
+
     if (!(dir = opendir("/proc")))
         goto out;
 
@@ -111,30 +369,7 @@ char *auto_detect_format(void) {
         if (pid == 0 || pid == mypid)
             continue;
 
-        char *name = NULL;
-        pid_t ppid;
-        int loopcnt = 0;
-        /* Now we need to find out the name of the process.
-         * To avoid the possible race condition of the process existing already
-         * but not executing the destination (shell after fork() and before
-         * exec()), we check if the name equals its parent.
-         *
-         * We try this for up to 0.5 seconds, then we give up.
-         */
-        do {
-            /* give the scheduler a chance between each iteration, don’t hog
-             * the CPU too much */
-            if (name) {
-                usleep(50);
-                free(name);
-            }
-
-            if (!parse_proc_stat(pid, &name, &ppid))
-                break;
-            if (ppid != myppid)
-                break;
-        } while (strcmp(parentname, name) == 0 && loopcnt++ < 10000);
-
+        char *name = child_name(pid, myppid, parentname);
         if (!name)
             continue;
 
@@ -146,13 +381,17 @@ char *auto_detect_format(void) {
             fprintf(stderr, "i3status: cannot auto-configure, situation ambiguous (format \"%s\" *and* \"%s\" detected)\n", newfmt, format);
             format = NULL;
             break;
-        } else {
+        } else if (newfmt) {
             format = newfmt;
         }
     }
 
     closedir(dir);
 
+cache:
+    if (format != NULL && have_cmdline)
+        cache_format(cmdline, format);
+
 out:
     if (parentname)
         free(parentname);
@@ -0,0 +1,326 @@
+// vim:ts=8:expandtab
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#if defined(LINUX)
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "i3status.h"
+
+/*
+ * Benchmark mode (i3status --bench N): every block of the configured order is
+ * rendered N times back to back and we measure, per block, the wall clock
+ * time, the CPU time, the number of system calls and the number of bytes of
+ * output it produces.
+ *
+ */
+
+struct sample {
+        double wall_us;
+        double cpu_us;
+        double syscalls;
+        double bytes;
+};
+
+struct bench_block {
+        const char *name;
+        int num_samples;
+        struct sample *samples;
+};
+
+/* One entry per block, plus one for the whole tick (at index num_blocks). */
+static struct bench_block *blocks;
+static unsigned int num_blocks;
+static int iterations;
+
+static struct sample start;
+static struct sample tick_start;
+static size_t start_bytes;
+static size_t tick_bytes;
+
+/* How system calls are counted, see syscall_count(). */
+static enum { SC_NONE, SC_PERF, SC_PROC_IO } syscall_source = SC_NONE;
+static int syscall_fd = -1;
+static double syscall_overhead = 0;
+
+static double timespec_us(const struct timespec *ts) {
+        return ts->tv_sec * 1e6 + ts->tv_nsec / 1e3;
+}
+
+#if defined(LINUX)
+/*
+ * Opens a perf counter for the raw_syscalls:sys_enter tracepoint, counting
+ * every system call of this thread. This needs access to tracefs and a
+ * permissive kernel.perf_event_paranoid setting.
+ *
+ */
+static int open_perf_syscall_counter(void) {
+        static const char *id_paths[] = {
+                "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+        };
+        struct perf_event_attr attr;
+        char buf[32];
+
+        for (size_t i = 0; i < sizeof(id_paths) / sizeof(id_paths[0]); i++) {
+                if (!slurp(id_paths[i], buf, sizeof(buf)) || atoi(buf) <= 0)
+                        continue;
+
+                memset(&attr, 0, sizeof(attr));
+                attr.type = PERF_TYPE_TRACEPOINT;
+                attr.size = sizeof(attr);
+                attr.config = atoi(buf);
+                attr.sample_period = 0;
+
+                int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+                if (fd != -1)
+                        return fd;
+        }
+        return -1;
+}
+#endif
+
+/*
+ * Returns the number of system calls made so far, or 0 if we have no way to
+ * count them. Without perf, the syscr/syscw fields of /proc/self/io are used,
+ * which only count read and write calls.
+ *
+ */
+static double syscall_count(void) {
+        char buf[512];
+        ssize_t n;
+
+        switch (syscall_source) {
+                case SC_PERF: {
+                        uint64_t count;
+                        if (read(syscall_fd, &count, sizeof(count)) != sizeof(count))
+                                return 0;
+                        return count;
+                }
+                case SC_PROC_IO: {
+                        double count = 0;
+                        if ((n = pread(syscall_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+                                return 0;
+                        buf[n] = '\0';
+                        for (char *walk = buf; walk != NULL; walk = strchr(walk, '\n')) {
+                                if (*walk == '\n')
+                                        walk++;
+                                if (BEGINS_WITH(walk, "syscr: ") || BEGINS_WITH(walk, "syscw: "))
+                                        count += strtoull(walk + strlen("syscr: "), NULL, 10);
+                        }
+                        return count;
+                }
+                default:
+                        return 0;
+        }
+}
+
+static void take_sample(struct sample *sample) {
+        struct timespec ts;
+
+        sample->syscalls = syscall_count();
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        sample->wall_us = timespec_us(&ts);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        sample->cpu_us = timespec_us(&ts);
+}
+
+static void add_sample(struct bench_block *block, const struct sample *begin, size_t bytes) {
+        struct sample now;
+        take_sample(&now);
+
+        struct sample *sample = &block->samples[block->num_samples++];
+        sample->wall_us = now.wall_us - begin->wall_us;
+        sample->cpu_us = now.cpu_us - begin->cpu_us;
+        sample->syscalls = max(now.syscalls - begin->syscalls - syscall_overhead, 0);
+        sample->bytes = bytes;
+}
+
+/*
+ * Prepares the benchmark for the given number of blocks and iterations.
+ *
+ */
+void bench_init(unsigned int blocks_in_order, int num_iterations) {
+        num_blocks = blocks_in_order;
+        iterations = num_iterations;
+
+        if ((blocks = calloc(num_blocks + 1, sizeof(struct bench_block))) == NULL)
+                die("Error: out of memory (calloc())\n");
+        for (unsigned int i = 0; i <= num_blocks; i++)
+                if ((blocks[i].samples = calloc(iterations, sizeof(struct sample))) == NULL)
+                        die("Error: out of memory (calloc())\n");
+        blocks[num_blocks].name = "(tick)";
+
+#if defined(LINUX)
+        if ((syscall_fd = open_perf_syscall_counter()) != -1)
+                syscall_source = SC_PERF;
+        else if ((syscall_fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC)) != -1)
+                syscall_source = SC_PROC_IO;
+#endif
+
+        /* Reading the counter costs system calls itself, which we don’t
+         * want to attribute to the blocks. */
+        if (syscall_source != SC_NONE) {
+                double first = syscall_count();
+                syscall_overhead = syscall_count() - first;
+        }
+}
+
+void bench_tick_start(void) {
+        tick_bytes = 0;
+        take_sample(&tick_start);
+}
+
+void bench_tick_end(void) {
+        add_sample(&blocks[num_blocks], &tick_start, tick_bytes);
+}
+
+void bench_block_start(void) {
+        start_bytes = output_line_len();
+        take_sample(&start);
+}
+
+void bench_block_end(unsigned int block, const char *name) {
+        size_t bytes = output_line_len() - start_bytes;
+
+        blocks[block].name = name;
+        add_sample(&blocks[block], &start, bytes);
+        tick_bytes += bytes;
+}
+
+static int compare_double(const void *a, const void *b) {
+        double da = *(const double *)a, db = *(const double *)b;
+        return (da > db) - (da < db);
+}
+
+/*
+ * Computes min, median and 99th percentile of the given field of all samples.
+ *
+ */
+static void summarize(const struct bench_block *block, size_t offset, double result[3]) {
+        int n = block->num_samples;
+        double *values;
+
+        if (n == 0 || (values = malloc(n * sizeof(double))) == NULL) {
+                result[0] = result[1] = result[2] = 0;
+                return;
+        }
+
+        for (int i = 0; i < n; i++)
+                values[i] = *(const double *)((const char *)&block->samples[i] + offset);
+        qsort(values, n, sizeof(double), compare_double);
+
+        int p99 = (int)(0.99 * n + 0.999999) - 1;
+        result[0] = values[0];
+        result[1] = (n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2);
+        result[2] = values[p99 < 0 ? 0 : p99];
+        free(values);
+}
+
+static const struct {
+        const char *name;
+        size_t offset;
+} metrics[] = {
+        {"wall_us", offsetof(struct sample, wall_us)},
+        {"cpu_us", offsetof(struct sample, cpu_us)},
+        {"syscalls", offsetof(struct sample, syscalls)},
+        {"bytes", offsetof(struct sample, bytes)},
+};
+
+#define NUM_METRICS (sizeof(metrics) / sizeof(metrics[0]))
+
+static const char *syscall_source_name(void) {
+        if (syscall_source == SC_PERF)
+                return "perf";
+        if (syscall_source == SC_PROC_IO)
+                return "proc_io";
+        return "none";
+}
+
+#define JSON_KEY(str) yajl_gen_string(json_gen, (const unsigned char *)str, strlen(str))
+
+static void report_json(void) {
+        const unsigned char *buf;
+#if YAJL_MAJOR >= 2
+        size_t len;
+        yajl_gen json_gen = yajl_gen_alloc(NULL);
+#else
+        unsigned int len;
+        yajl_gen json_gen = yajl_gen_alloc(NULL, NULL);
+#endif
+        double result[3];
+
+        yajl_gen_map_open(json_gen);
+        JSON_KEY("iterations");
+        yajl_gen_integer(json_gen, iterations);
+        JSON_KEY("syscall_source");
+        JSON_KEY(syscall_source_name());
+        JSON_KEY("blocks");
+        yajl_gen_array_open(json_gen);
+        for (unsigned int i = 0; i <= num_blocks; i++) {
+                yajl_gen_map_open(json_gen);
+                JSON_KEY("name");
+                JSON_KEY(blocks[i].name);
+                for (size_t m = 0; m < NUM_METRICS; m++) {
+                        summarize(&blocks[i], metrics[m].offset, result);
+                        JSON_KEY(metrics[m].name);
+                        yajl_gen_map_open(json_gen);
+                        JSON_KEY("min");
+                        yajl_gen_double(json_gen, result[0]);
+                        JSON_KEY("median");
+                        yajl_gen_double(json_gen, result[1]);
+                        JSON_KEY("p99");
+                        yajl_gen_double(json_gen, result[2]);
+                        yajl_gen_map_close(json_gen);
+                }
+                yajl_gen_map_close(json_gen);
+        }
+        yajl_gen_array_close(json_gen);
+        yajl_gen_map_close(json_gen);
+
+        yajl_gen_get_buf(json_gen, &buf, &len);
+        fwrite(buf, 1, len, stdout);
+        printf("\n");
+        yajl_gen_free(json_gen);
+}
+
+static void report_text(void) {
+        double result[3];
+
+        printf("i3status benchmark: %d iterations, syscalls counted via %s\n", iterations, syscall_source_name());
+        printf("%-24s %-26s %-26s %-20s %s\n", "block", "wall us (min/med/p99)",
+               "cpu us (min/med/p99)", "syscalls", "bytes");
+        for (unsigned int i = 0; i <= num_blocks; i++) {
+                printf("%-24s", blocks[i].name);
+                for (size_t m = 0; m < NUM_METRICS; m++) {
+                        summarize(&blocks[i], metrics[m].offset, result);
+                        if (m < 2)
+                                printf(" %8.1f/%8.1f/%8.1f", result[0], result[1], result[2]);
+                        else printf(" %6.0f/%6.0f/%6.0f", result[0], result[1], result[2]);
+                }
+                printf("\n");
+        }
+}
+
+/*
+ * Prints min, median and 99th percentile of all metrics per block to stdout,
+ * either as a table or as JSON.
+ *
+ */
+void bench_report(bool json) {
+        if (json)
+                report_json();
+        else report_text();
+        fflush(stdout);
+}
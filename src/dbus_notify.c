@@ -0,0 +1,350 @@
+// vim:ts=8:expandtab
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "i3status.h"
+
+/*
+ * A minimal client for the org.freedesktop.Notifications D-Bus interface.
+ * It speaks just enough of the D-Bus wire protocol to authenticate on the
+ * session bus and send Notify method calls, so that notifications work
+ * without linking against libnotify and the whole GTK/GLib stack.
+ *
+ * See https://dbus.freedesktop.org/doc/dbus-specification.html
+ *
+ */
+
+#define DBUS_MESSAGE_SIZE 4096
+
+#define DBUS_TYPE_METHOD_CALL 1
+#define DBUS_FLAG_NO_REPLY_EXPECTED 0x1
+
+#define DBUS_HEADER_PATH 1
+#define DBUS_HEADER_INTERFACE 2
+#define DBUS_HEADER_MEMBER 3
+#define DBUS_HEADER_DESTINATION 6
+#define DBUS_HEADER_SIGNATURE 8
+
+/* Seconds after which a blocking send/receive on the bus is given up. */
+#define DBUS_TIMEOUT 5
+
+/* The notification urgency levels, see the Desktop Notifications
+ * Specification. */
+#define URGENCY_NORMAL 1
+#define URGENCY_CRITICAL 2
+
+struct dbus_message {
+        unsigned char buf[DBUS_MESSAGE_SIZE];
+        size_t len;
+        bool overflow;
+};
+
+static int bus_fd = -1;
+static uint32_t serial = 0;
+
+static void msg_align(struct dbus_message *msg, size_t alignment) {
+        while (msg->len % alignment != 0) {
+                if (msg->len >= DBUS_MESSAGE_SIZE) {
+                        msg->overflow = true;
+                        return;
+                }
+                msg->buf[msg->len++] = '\0';
+        }
+}
+
+static void msg_put(struct dbus_message *msg, const void *data, size_t len) {
+        if (msg->len + len > DBUS_MESSAGE_SIZE) {
+                msg->overflow = true;
+                return;
+        }
+        memcpy(msg->buf + msg->len, data, len);
+        msg->len += len;
+}
+
+static void msg_put_byte(struct dbus_message *msg, uint8_t value) {
+        msg_put(msg, &value, 1);
+}
+
+/* All integers are sent in host byte order, which is announced in the
+ * first byte of the header. */
+static void msg_put_u32(struct dbus_message *msg, uint32_t value) {
+        msg_align(msg, 4);
+        msg_put(msg, &value, sizeof(value));
+}
+
+static void msg_put_string(struct dbus_message *msg, const char *str) {
+        msg_put_u32(msg, strlen(str));
+        msg_put(msg, str, strlen(str) + 1);
+}
+
+static void msg_put_signature(struct dbus_message *msg, const char *signature) {
+        msg_put_byte(msg, strlen(signature));
+        msg_put(msg, signature, strlen(signature) + 1);
+}
+
+/*
+ * Appends one (code, variant) header field.
+ *
+ */
+static void msg_put_field(struct dbus_message *msg, uint8_t code, const char *type, const char *value) {
+        msg_align(msg, 8);
+        msg_put_byte(msg, code);
+        msg_put_signature(msg, type);
+        if (*type == 'g')
+                msg_put_signature(msg, value);
+        else msg_put_string(msg, value);
+}
+
+/*
+ * Starts a method call message, including all header fields. The body length
+ * is filled in by msg_finish() once the body has been appended.
+ *
+ */
+static void msg_method_call(struct dbus_message *msg, const char *destination, const char *path,
+                            const char *interface, const char *member, const char *signature, uint8_t flags) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        msg_put_byte(msg, 'B');
+#else
+        msg_put_byte(msg, 'l');
+#endif
+        msg_put_byte(msg, DBUS_TYPE_METHOD_CALL);
+        msg_put_byte(msg, flags);
+        msg_put_byte(msg, 1);
+        msg_put_u32(msg, 0);
+        msg_put_u32(msg, ++serial);
+        msg_put_u32(msg, 0);
+
+        msg_put_field(msg, DBUS_HEADER_PATH, "o", path);
+        msg_put_field(msg, DBUS_HEADER_INTERFACE, "s", interface);
+        msg_put_field(msg, DBUS_HEADER_MEMBER, "s", member);
+        msg_put_field(msg, DBUS_HEADER_DESTINATION, "s", destination);
+        if (signature != NULL)
+                msg_put_field(msg, DBUS_HEADER_SIGNATURE, "g", signature);
+
+        uint32_t fields_len = msg->len - 16;
+        memcpy(msg->buf + 12, &fields_len, sizeof(fields_len));
+
+        /* The body always starts on an 8-byte boundary. */
+        msg_align(msg, 8);
+}
+
+static void msg_finish(struct dbus_message *msg, size_t body_start) {
+        uint32_t body_len = msg->len - body_start;
+        memcpy(msg->buf + 4, &body_len, sizeof(body_len));
+}
+
+static bool bus_send(const void *data, size_t len) {
+        const char *walk = data;
+
+        while (len > 0) {
+                /* MSG_NOSIGNAL: a closed bus must not trigger our SIGPIPE
+                 * handler, which would make i3status exit. */
+                ssize_t n = send(bus_fd, walk, len, MSG_NOSIGNAL);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        return false;
+                }
+                walk += n;
+                len -= n;
+        }
+        return true;
+}
+
+/*
+ * We never wait for replies, but the bus sends some anyway (e.g. for Hello).
+ * Discard everything which arrived so far so that it doesn’t pile up.
+ *
+ */
+static void bus_drain(void) {
+        char buf[512];
+        while (recv(bus_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                ;
+}
+
+void dbus_disconnect(void) {
+        if (bus_fd != -1)
+                (void)close(bus_fd);
+        bus_fd = -1;
+}
+
+/*
+ * Fills in the socket address of the session bus, taken from
+ * $DBUS_SESSION_BUS_ADDRESS (only unix:path= and unix:abstract= transports
+ * are supported) or $XDG_RUNTIME_DIR/bus.
+ *
+ */
+static bool session_bus_address(struct sockaddr_un *addr, socklen_t *addrlen) {
+        const char *address = getenv("DBUS_SESSION_BUS_ADDRESS");
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        const char *walk;
+        size_t offset = 0, len;
+
+        memset(addr, 0, sizeof(struct sockaddr_un));
+        addr->sun_family = AF_UNIX;
+
+        if (address == NULL) {
+                if (runtime_dir == NULL)
+                        return false;
+                if ((size_t)snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/bus", runtime_dir) >= sizeof(addr->sun_path))
+                        return false;
+                *addrlen = sizeof(struct sockaddr_un);
+                return true;
+        }
+
+        /* Multiple addresses are separated by semicolons, we use the first
+         * one we understand. */
+        for (walk = address; *walk != '\0'; walk += strcspn(walk, ";") + (walk[strcspn(walk, ";")] == ';')) {
+                if (BEGINS_WITH(walk, "unix:path=")) {
+                        walk += strlen("unix:path=");
+                } else if (BEGINS_WITH(walk, "unix:abstract=")) {
+                        walk += strlen("unix:abstract=");
+                        offset = 1;
+                } else continue;
+
+                len = strcspn(walk, ",;");
+                if (offset + len >= sizeof(addr->sun_path))
+                        return false;
+                memcpy(addr->sun_path + offset, walk, len);
+                *addrlen = (offset ? offsetof(struct sockaddr_un, sun_path) + offset + len : sizeof(struct sockaddr_un));
+                return true;
+        }
+
+        return false;
+}
+
+/*
+ * Connects to the session bus, authenticates using the EXTERNAL mechanism
+ * and registers with the bus using Hello.
+ *
+ */
+static bool dbus_connect(void) {
+        struct sockaddr_un addr;
+        socklen_t addrlen;
+        struct timeval timeout = {DBUS_TIMEOUT, 0};
+        char buf[128];
+        char auth[64];
+        char uid[16];
+        size_t len = 0;
+
+        if (!session_bus_address(&addr, &addrlen))
+                return false;
+
+        if ((bus_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+                return false;
+
+        (void)setsockopt(bus_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        (void)setsockopt(bus_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        if (connect(bus_fd, (struct sockaddr *)&addr, addrlen) == -1)
+                goto error;
+
+        /* The EXTERNAL mechanism expects our uid as hex-encoded decimal
+         * string. The connection starts with a single NUL byte. */
+        (void)snprintf(uid, sizeof(uid), "%d", (int)getuid());
+        len = sprintf(auth, "%cAUTH EXTERNAL ", '\0');
+        for (char *walk = uid; *walk != '\0'; walk++)
+                len += sprintf(auth + len, "%02x", (unsigned char)*walk);
+        len += sprintf(auth + len, "\r\n");
+        if (!bus_send(auth, len))
+                goto error;
+
+        len = 0;
+        while (len < sizeof(buf) - 1 && (len < 2 || buf[len - 1] != '\n')) {
+                ssize_t n = recv(bus_fd, buf + len, sizeof(buf) - 1 - len, 0);
+                if (n <= 0)
+                        goto error;
+                len += n;
+        }
+        buf[len] = '\0';
+        if (!BEGINS_WITH(buf, "OK "))
+                goto error;
+
+        if (!bus_send("BEGIN\r\n", strlen("BEGIN\r\n")))
+                goto error;
+
+        struct dbus_message msg = { .len = 0, .overflow = false };
+        msg_method_call(&msg, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                        "org.freedesktop.DBus", "Hello", NULL, 0);
+        msg_finish(&msg, msg.len);
+        if (msg.overflow || !bus_send(msg.buf, msg.len))
+                goto error;
+
+        return true;
+
+error:
+        dbus_disconnect();
+        return false;
+}
+
+/*
+ * Sends a notification using org.freedesktop.Notifications.Notify. The
+ * connection to the session bus is established on first use and re-opened
+ * once if sending fails (e.g. because the bus was restarted).
+ *
+ */
+bool dbus_send_notification(const char *app_name, const char *summary, const char *body, bool critical) {
+        struct dbus_message msg = { .len = 0, .overflow = false };
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+                if (bus_fd == -1 && !dbus_connect())
+                        return false;
+
+                bus_drain();
+
+                msg.len = 0;
+                msg.overflow = false;
+                msg_method_call(&msg, "org.freedesktop.Notifications", "/org/freedesktop/Notifications",
+                                "org.freedesktop.Notifications", "Notify", "susssasa{sv}i",
+                                DBUS_FLAG_NO_REPLY_EXPECTED);
+                size_t body_start = msg.len;
+
+                msg_put_string(&msg, app_name);
+                msg_put_u32(&msg, 0);
+                msg_put_string(&msg, "dialog-information");
+                msg_put_string(&msg, summary);
+                msg_put_string(&msg, body);
+
+                /* actions: empty array of strings */
+                msg_put_u32(&msg, 0);
+
+                /* hints: a{sv} containing the urgency. The array length does
+                 * not include the padding before the first entry. */
+                msg_put_u32(&msg, 0);
+                size_t hints_len_offset = msg.len - 4;
+                msg_align(&msg, 8);
+                size_t hints_start = msg.len;
+                msg_put_string(&msg, "urgency");
+                msg_put_signature(&msg, "y");
+                msg_put_byte(&msg, critical ? URGENCY_CRITICAL : URGENCY_NORMAL);
+                uint32_t hints_len = msg.len - hints_start;
+                memcpy(msg.buf + hints_len_offset, &hints_len, sizeof(hints_len));
+
+                /* expire_timeout: -1 lets the server decide */
+                msg_put_u32(&msg, (uint32_t)-1);
+
+                msg_finish(&msg, body_start);
+
+                if (msg.overflow) {
+                        fprintf(stderr, "i3status: notification too long for D-Bus message\n");
+                        return false;
+                }
+
+                if (bus_send(msg.buf, msg.len))
+                        return true;
+
+                dbus_disconnect();
+        }
+
+        return false;
+}
@@ -0,0 +1,257 @@
+// vim:ts=8:expandtab
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include "i3status.h"
+
+/*
+ * A minimal event loop: modules (and the stats socket) register file
+ * descriptors together with a callback, and the main loop waits on all of
+ * them using poll() instead of sleeping until the next update is due.
+ *
+ * Callbacks which notice that the status line is outdated (e.g. a device
+ * appeared) call events_request_refresh() so that the main loop renders a new
+ * line right away instead of waiting for the next interval. Signal handlers and
+ * other threads use events_wakeup() instead.
+ *
+ * Only the blocks which depend on the changed source are rendered again: while
+ * a block is rendered, the module calls events_depend() with the same source
+ * pointer its callback passes to events_request_refresh(). All other blocks
+ * are served from the cache.
+ *
+ */
+
+#define MAX_EVENT_SOURCES 32
+
+struct event_source {
+        event_cb cb;
+        void *data;
+};
+
+static struct pollfd pollfds[MAX_EVENT_SOURCES];
+static struct event_source sources[MAX_EVENT_SOURCES];
+static int num_sources = 0;
+static bool refresh_requested = false;
+
+struct dependency {
+        const void *source;
+        unsigned int block;
+};
+
+static struct dependency *dependencies = NULL;
+static int num_dependencies = 0;
+/* The block being rendered, or -1. */
+static int current_block = -1;
+/* Per block: whether a refresh of the block was requested. */
+static bool *block_refresh = NULL;
+static unsigned int num_blocks = 0;
+
+/* Self-pipe used by events_wakeup(). */
+static int wakeup_pipe[2] = {-1, -1};
+
+/*
+ * Registers a file descriptor which is watched for the given poll() events
+ * while waiting for the next update. cb is called with the returned events.
+ *
+ */
+void events_add(int fd, short events, event_cb cb, void *data) {
+        if (num_sources == MAX_EVENT_SOURCES)
+                die("Too many event sources (max %d)\n", MAX_EVENT_SOURCES);
+
+        pollfds[num_sources].fd = fd;
+        pollfds[num_sources].events = events;
+        pollfds[num_sources].revents = 0;
+        sources[num_sources].cb = cb;
+        sources[num_sources].data = data;
+        num_sources++;
+}
+
+/*
+ * Stops watching the given file descriptor. This may be called from within a
+ * callback.
+ *
+ */
+void events_remove(int fd) {
+        for (int i = 0; i < num_sources; i++) {
+                if (pollfds[i].fd != fd)
+                        continue;
+                num_sources--;
+                pollfds[i] = pollfds[num_sources];
+                sources[i] = sources[num_sources];
+                return;
+        }
+}
+
+/*
+ * Sets up the refresh state for the given number of blocks.
+ *
+ */
+void events_init_blocks(unsigned int blocks) {
+        if ((block_refresh = calloc(blocks, sizeof(bool))) == NULL)
+                die("Error: out of memory\n");
+        num_blocks = blocks;
+}
+
+/*
+ * Sets the block which is being rendered, or -1 after rendering it.
+ *
+ */
+void events_set_block(int block) {
+        current_block = block;
+}
+
+/*
+ * Records that the block being rendered shows data of the given source, so
+ * that it is rendered again when a refresh of the source is requested.
+ *
+ */
+void events_depend(const void *source) {
+        if (current_block == -1)
+                return;
+        for (int i = 0; i < num_dependencies; i++)
+                if (dependencies[i].source == source && dependencies[i].block == (unsigned int)current_block)
+                        return;
+
+        struct dependency *grown = realloc(dependencies, sizeof(struct dependency) * (num_dependencies + 1));
+        if (grown == NULL)
+                die("Error: out of memory\n");
+        dependencies = grown;
+        dependencies[num_dependencies].source = source;
+        dependencies[num_dependencies].block = current_block;
+        num_dependencies++;
+}
+
+/*
+ * Requests that the blocks depending on the given source are rendered again
+ * right away. NULL refreshes all blocks.
+ *
+ */
+void events_request_refresh(const void *source) {
+        if (source == NULL) {
+                for (unsigned int i = 0; i < num_blocks; i++)
+                        block_refresh[i] = true;
+                refresh_requested = true;
+                return;
+        }
+
+        for (int i = 0; i < num_dependencies; i++) {
+                /* A block which is being rendered reads the new state
+                 * anyway. */
+                if (dependencies[i].source != source || (int)dependencies[i].block == current_block)
+                        continue;
+                block_refresh[dependencies[i].block] = true;
+                refresh_requested = true;
+        }
+}
+
+/*
+ * Returns whether a refresh of the given block was requested, and clears the
+ * request.
+ *
+ */
+bool events_refresh_due(unsigned int block) {
+        bool due = (block < num_blocks && block_refresh[block]);
+        if (due)
+                block_refresh[block] = false;
+        return due;
+}
+
+static void drain_wakeup_pipe(int fd, short revents, void *data) {
+        char buf[64];
+        while (read(fd, buf, sizeof(buf)) > 0)
+                ;
+        events_request_refresh(NULL);
+}
+
+/*
+ * Sets up the self-pipe used by events_wakeup().
+ *
+ */
+void events_init(void) {
+        if (pipe2(wakeup_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+                die("pipe2() failed: %s\n", strerror(errno));
+        events_add(wakeup_pipe[0], POLLIN, drain_wakeup_pipe, NULL);
+}
+
+/*
+ * Makes the main loop render a new status line as soon as possible. Unlike
+ * events_request_refresh(), this is async-signal-safe and may be called from
+ * other threads. A wakeup arriving while a status line is being rendered is
+ * not lost, it makes the next events_wait() return right away.
+ *
+ */
+void events_wakeup(void) {
+        int saved_errno = errno;
+        if (wakeup_pipe[1] != -1)
+                (void)write(wakeup_pipe[1], "", 1);
+        errno = saved_errno;
+}
+
+/*
+ * Returns the time in milliseconds since some unspecified point, unaffected
+ * by changes of the wall clock.
+ *
+ */
+long long events_monotonic_ms(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Like events_monotonic_ms(), but in seconds with sub-millisecond precision,
+ * for measuring durations and rates.
+ *
+ */
+double events_monotonic_seconds(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Waits for the given amount of time while dispatching events. Returns true
+ * early if a callback requested a refresh or events_wakeup() was called (e.g.
+ * upon SIGUSR1), also if that happened while the last status line was being
+ * rendered.
+ *
+ */
+bool events_wait(const struct timespec *timeout) {
+        /* Round up: waking up too early would render the same second
+         * twice. */
+        long long deadline = events_monotonic_ms() + timeout->tv_sec * 1000LL + (timeout->tv_nsec + 999999) / 1000000;
+        long long now;
+
+        while (!refresh_requested && (now = events_monotonic_ms()) < deadline) {
+                int n = poll(pollfds, num_sources, (int)(deadline - now));
+                if (n == -1) {
+                        /* Signal handlers which need a refresh call
+                         * events_wakeup(), handled in the next poll(). */
+                        if (errno == EINTR)
+                                continue;
+                        die("poll() failed: %s\n", strerror(errno));
+                }
+
+                /* Iterate backwards so that callbacks can remove their own
+                 * file descriptor. */
+                for (int i = num_sources - 1; n > 0 && i >= 0; i--) {
+                        if (pollfds[i].revents == 0)
+                                continue;
+                        short revents = pollfds[i].revents;
+                        pollfds[i].revents = 0;
+                        n--;
+                        sources[i].cb(pollfds[i].fd, revents, sources[i].data);
+                }
+        }
+
+        bool requested = refresh_requested;
+        refresh_requested = false;
+        return requested;
+}
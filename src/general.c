@@ -7,9 +7,65 @@
 #include <unistd.h>
 #include <sys/fcntl.h>
 #include <sys/stat.h>
+#include <limits.h>
+#include <glob.h>
 
 #include "i3status.h"
 
+static const char *fs_root = NULL;
+
+/*
+ * Sets the directory which absolute paths of system files (like /proc/stat or
+ * /sys/class/power_supply/BAT0/uevent) are resolved against. This allows
+ * feeding modules with recorded files, see contrib/replay.py.
+ *
+ */
+void set_fs_root(const char *root) {
+        fs_root = (root != NULL && *root != '\0' ? root : NULL);
+}
+
+/*
+ * Returns path with fs_root prepended, using buf if necessary. Relative paths
+ * and paths without a configured fs_root are returned unchanged.
+ *
+ */
+const char *root_path(const char *path, char *buf, size_t size) {
+        if (fs_root == NULL || path[0] != '/')
+                return path;
+        (void)snprintf(buf, size, "%s%s", fs_root, path);
+        return buf;
+}
+
+/*
+ * Like open(2), but relative to fs_root.
+ *
+ */
+int open_rooted(const char *path, int flags) {
+        char buf[PATH_MAX];
+        return open(root_path(path, buf, sizeof(buf)), flags);
+}
+
+/*
+ * Like glob(3), but relative to fs_root. The prefix is removed from the
+ * returned paths again, so that they can be compared with configured paths
+ * and passed to open_rooted().
+ *
+ */
+int glob_rooted(const char *pattern, int flags, glob_t *pglob) {
+        char buf[PATH_MAX];
+        const char *rooted = root_path(pattern, buf, sizeof(buf));
+        int ret = glob(rooted, flags, NULL, pglob);
+
+        if (ret != 0 || rooted == pattern)
+                return ret;
+
+        size_t prefix_len = strlen(fs_root);
+        for (size_t i = 0; i < pglob->gl_pathc; i++)
+                memmove(pglob->gl_pathv[i], pglob->gl_pathv[i] + prefix_len,
+                        strlen(pglob->gl_pathv[i] + prefix_len) + 1);
+        return ret;
+}
+
 /*
  * Reads size bytes into the destination buffer from filename.
  *
@@ -17,14 +73,17 @@
 bool slurp(const char *filename, char *destination, int size) {
         int fd;
 
-        if ((fd = open(filename, O_RDONLY)) == -1)
+        if ((fd = open_rooted(filename, O_RDONLY)) == -1)
                 return false;
 
         /* We need one byte for the trailing 0 byte */
         int n = read(fd, destination, size-1);
-        if (n != -1)
-                destination[n] = '\0';
         (void)close(fd);
+        /* Some sysfs attributes (e.g. the speed of a link which is down)
+         * cannot be read even though they exist. */
+        if (n == -1)
+                return false;
+        destination[n] = '\0';
 
         return true;
 }
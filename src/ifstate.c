@@ -0,0 +1,89 @@
+// vim:ts=8:expandtab
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "i3status.h"
+
+/*
+ * Tracks changes of network interfaces. On Linux, an rtnetlink socket is
+ * watched by the event loop and every link change (an interface going up or
+ * down, a cable being plugged in, …) or address change bumps a generation
+ * counter. Modules cache what they read about interfaces together with the
+ * generation and only read it again once the generation changed. Changes
+ * also refresh the blocks which asked for the generation right away.
+ *
+ * Without rtnetlink, every call to ifstate_generation() returns a new value,
+ * so that nothing is cached.
+ *
+ */
+
+static unsigned long generation = 1;
+static bool initialized = false;
+static bool watching = false;
+
+#if defined(LINUX)
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+static void rtnetlink_receive(int fd, short revents, void *data) {
+        char buf[8192];
+        ssize_t n;
+        bool changed = false;
+
+        /* The contents of the messages do not matter, we just read the
+         * interfaces again. ENOBUFS means that messages were lost, which is
+         * a change as well. */
+        while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) != 0) {
+                if (n == -1 && errno != ENOBUFS)
+                        break;
+                changed = true;
+        }
+
+        if (changed) {
+                generation++;
+                events_request_refresh(&generation);
+        }
+}
+
+static void ifstate_init(void) {
+        struct sockaddr_nl addr;
+        int fd;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+
+        if ((fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE)) == -1)
+                return;
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+                fprintf(stderr, "i3status: Cannot watch network interfaces: %s\n", strerror(errno));
+                (void)close(fd);
+                return;
+        }
+        events_add(fd, POLLIN, rtnetlink_receive, NULL);
+        watching = true;
+}
+#else
+static void ifstate_init(void) {
+}
+#endif
+
+/*
+ * Returns a counter which changes whenever a network interface changed.
+ *
+ */
+unsigned long ifstate_generation(void) {
+        if (!initialized) {
+                initialized = true;
+                ifstate_init();
+        }
+        if (!watching)
+                generation++;
+        events_depend(&generation);
+        return generation;
+}
@@ -0,0 +1,262 @@
+// vim:ts=8:expandtab
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined(WITH_LIBNOTIFY)
+#include <libnotify/notify.h>
+#endif
+
+#include "i3status.h"
+
+/* Number of notifications which can be pending at the same time. Since
+ * notifications are coalesced per source, this only needs to be larger than
+ * the number of distinct sources (batteries, mpd). */
+#define NOTIFICATION_QUEUE_SIZE 8
+
+/* Minimum number of seconds between two notifications of the same source.
+ * Notifications arriving faster than that replace the pending one. */
+#define NOTIFICATION_MIN_INTERVAL 2
+
+struct notification {
+        char source[64];
+        char summary[256];
+        char body[512];
+        bool critical;
+};
+
+struct source_state {
+        char source[64];
+        time_t last_shown;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static bool worker_started = false;
+static bool stopping = false;
+
+/* Pending notifications (oldest first), protected by lock. */
+static struct notification queue[NOTIFICATION_QUEUE_SIZE];
+static int queue_len = 0;
+
+/* Only accessed by the worker thread. */
+static struct source_state sources[NOTIFICATION_QUEUE_SIZE];
+
+/*
+ * Removes the pending notification at position idx from the queue.
+ *
+ */
+static void queue_remove(int idx) {
+        for (int i = idx; i < queue_len - 1; i++)
+                queue[i] = queue[i + 1];
+        queue_len--;
+}
+
+/*
+ * Returns the rate limiting state of the given source. Entries are recycled
+ * in LRU order when the table is full.
+ *
+ */
+static struct source_state *get_source(const char *source) {
+        struct source_state *oldest = &sources[0];
+
+        for (int i = 0; i < NOTIFICATION_QUEUE_SIZE; i++) {
+                if (strcmp(sources[i].source, source) == 0)
+                        return &sources[i];
+                if (sources[i].last_shown < oldest->last_shown)
+                        oldest = &sources[i];
+        }
+
+        (void)snprintf(oldest->source, sizeof(oldest->source), "%s", source);
+        oldest->last_shown = 0;
+        return oldest;
+}
+
+#if defined(WITH_LIBNOTIFY)
+/*
+ * Shows the notification using libnotify. Only notify_init() is deferred until
+ * the first notification is due; libnotify and GTK are linked in and thus
+ * still loaded at startup (build with WITH_LIBNOTIFY=0 to avoid that).
+ *
+ */
+static void libnotify_show(const struct notification *notification) {
+        if (!notify_is_initted() && !notify_init("i3status"))
+                return;
+
+        NotifyNotification *notif = notify_notification_new(notification->summary, notification->body, "dialog-information");
+
+        if (notification->critical)
+                notify_notification_set_urgency(notif, NOTIFY_URGENCY_CRITICAL);
+
+        notify_notification_show(notif, NULL);
+        g_object_unref(G_OBJECT(notif));
+}
+
+static void libnotify_cleanup(void) {
+        if (notify_is_initted())
+                notify_uninit();
+}
+#endif
+
+static void dbus_show(const struct notification *notification) {
+        if (!dbus_send_notification("i3status", notification->summary, notification->body, notification->critical))
+                fprintf(stderr, "i3status: could not send notification via D-Bus\n");
+}
+
+/*
+ * The available notification backends. The first one is used when
+ * notification_backend is set to "auto".
+ *
+ */
+static const struct notification_backend {
+        const char *name;
+        void (*show)(const struct notification *notification);
+        void (*cleanup)(void);
+} backends[] = {
+#if defined(WITH_LIBNOTIFY)
+        {"libnotify", libnotify_show, libnotify_cleanup},
+#endif
+        {"dbus", dbus_show, dbus_disconnect},
+        {"none", NULL, NULL},
+};
+
+static const struct notification_backend *backend = &backends[0];
+
+/*
+ * Selects the notification backend by name. Returns false if the name is
+ * unknown or the backend was not compiled in.
+ *
+ */
+bool set_notification_backend(const char *name) {
+        if (strcasecmp(name, "auto") == 0) {
+                backend = &backends[0];
+                return true;
+        }
+
+        for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+                if (strcasecmp(backends[i].name, name) == 0) {
+                        backend = &backends[i];
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/*
+ * Waits for pending notifications and shows them, at most one every
+ * NOTIFICATION_MIN_INTERVAL seconds per source.
+ *
+ */
+static void *notification_worker(void *arg) {
+        struct notification current;
+
+        pthread_mutex_lock(&lock);
+        while (!stopping) {
+                time_t now = time(NULL);
+                time_t next_due = 0;
+                int ready = -1;
+
+                for (int i = 0; i < queue_len; i++) {
+                        time_t due = get_source(queue[i].source)->last_shown + NOTIFICATION_MIN_INTERVAL;
+                        if (due <= now) {
+                                ready = i;
+                                break;
+                        }
+                        if (next_due == 0 || due < next_due)
+                                next_due = due;
+                }
+
+                if (ready == -1) {
+                        if (queue_len == 0) {
+                                pthread_cond_wait(&cond, &lock);
+                        } else {
+                                struct timespec deadline = {next_due, 0};
+                                pthread_cond_timedwait(&cond, &lock, &deadline);
+                        }
+                        continue;
+                }
+
+                current = queue[ready];
+                queue_remove(ready);
+                get_source(current.source)->last_shown = now;
+
+                /* This may block for a long time if the notification daemon
+                 * is slow or missing, which is why it only ever runs in this
+                 * thread. */
+                pthread_mutex_unlock(&lock);
+                backend->show(&current);
+                pthread_mutex_lock(&lock);
+        }
+        pthread_mutex_unlock(&lock);
+
+        backend->cleanup();
+
+        return NULL;
+}
+
+/*
+ * Queues a desktop notification. This never blocks on the notification
+ * daemon: the notification is shown asynchronously by a worker thread, which
+ * is started on first use.
+ *
+ * A pending notification of the same source is replaced instead of queueing
+ * another one. When the queue is full, the oldest notification is dropped.
+ *
+ */
+void send_notification(const char *source, const char *summary, const char *body, bool critical) {
+        struct notification *notification = NULL;
+
+        pthread_mutex_lock(&lock);
+
+        if (stopping || backend->show == NULL)
+                goto out;
+
+        if (!worker_started) {
+                if ((errno = pthread_create(&worker, NULL, notification_worker, NULL)) != 0) {
+                        perror("i3status: pthread_create()");
+                        goto out;
+                }
+                worker_started = true;
+        }
+
+        for (int i = 0; i < queue_len; i++) {
+                if (strcmp(queue[i].source, source) == 0) {
+                        notification = &queue[i];
+                        break;
+                }
+        }
+
+        if (notification == NULL) {
+                if (queue_len == NOTIFICATION_QUEUE_SIZE) {
+                        fprintf(stderr, "i3status: notification queue full, dropping \"%s\"\n", queue[0].summary);
+                        queue_remove(0);
+                }
+                notification = &queue[queue_len++];
+        }
+
+        (void)snprintf(notification->source, sizeof(notification->source), "%s", source);
+        (void)snprintf(notification->summary, sizeof(notification->summary), "%s", summary);
+        (void)snprintf(notification->body, sizeof(notification->body), "%s", body);
+        notification->critical = critical;
+
+        pthread_cond_signal(&cond);
+out:
+        pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Tells the worker thread to exit. We intentionally don’t wait for it: if it
+ * is stuck talking to the notification daemon, exiting must not be delayed.
+ *
+ */
+void stop_notifications(void) {
+        pthread_mutex_lock(&lock);
+        stopping = true;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&lock);
+}
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <fcntl.h>
@@ -11,19 +13,353 @@
 #include "i3status.h"
 
 /*
- * Returns the correct color format for dzen (^fg(color)) or xmobar (<fc=color>)
+ * The keys used in i3bar blocks, already in their JSON form including the
+ * separating comma and the opening quote of the value. The plain key (for the
+ * yajl emitter) starts at the third character and is key_len bytes long.
  *
  */
-char *color(const char *colorstr) {
-        static char colorbuf[32];
-        if (!cfg_getbool(cfg_general, "colors")) {
-                colorbuf[0] = '\0';
-                return colorbuf;
+#define I3BAR_KEY(key) {",\"" key "\":\"", sizeof(",\"" key "\":\"") - 1, sizeof(key) - 1}
+static const struct {
+        const char *json;
+        size_t json_len;
+        size_t key_len;
+} i3bar_keys[] = {
+        [KEY_NAME] = I3BAR_KEY("name"),
+        [KEY_INSTANCE] = I3BAR_KEY("instance"),
+        [KEY_FULL_TEXT] = I3BAR_KEY("full_text"),
+        [KEY_COLOR] = I3BAR_KEY("color"),
+};
+
+static enum { EMITTER_NATIVE, EMITTER_YAJL } json_emitter = EMITTER_NATIVE;
+
+/*
+ * The output line, used for all formats. The yajl emitter generates one block
+ * at a time, which is then copied into the line. The buffer is reused for
+ * every line and grown to fit the previous line (plus some slack) before a new
+ * line is started, so that it is rarely reallocated while blocks are rendered.
+ *
+ */
+static struct {
+        char *buf;
+        size_t len;
+        size_t size;
+} line;
+static bool first_line = true;
+static bool first_block;
+
+/*
+ * The output of every block as rendered the last time, so that blocks which
+ * are not due for an update can be repeated without running the module. For
+ * i3bar, the separating comma is not included.
+ *
+ */
+static struct block_output {
+        char *buf;
+        size_t len;
+        size_t size;
+} *block_outputs;
+static unsigned int num_block_outputs;
+static size_t block_start;
+
+/*
+ * The color escape sequences of the general colors for the configured output
+ * format, computed once by init_colors().
+ *
+ */
+static struct {
+        const char *name;
+        char start[32];
+} colors[] = {
+        {"color_good", ""},
+        {"color_degraded", ""},
+        {"color_bad", ""},
+        {"color_separator", ""},
+};
+
+static char separator[64];
+
+/*
+ * Selects how the i3bar JSON output is generated: "native" (the default)
+ * writes it directly into a reusable buffer, "yajl" uses the yajl generator.
+ * Returns false for unknown names.
+ *
+ */
+bool set_json_emitter(const char *name) {
+        if (strcasecmp(name, "native") == 0)
+                json_emitter = EMITTER_NATIVE;
+        else if (strcasecmp(name, "yajl") == 0)
+                json_emitter = EMITTER_YAJL;
+        else return false;
+        return true;
+}
+
+static void line_reserve(size_t len) {
+        if (line.len + len <= line.size)
+                return;
+        size_t size = max(line.size * 2, line.len + len);
+        if ((line.buf = realloc(line.buf, size)) == NULL)
+                die("Error: out of memory (realloc(%zd))\n", size);
+        line.size = size;
+}
+
+static void line_append(const char *str, size_t len) {
+        line_reserve(len);
+        memcpy(line.buf + line.len, str, len);
+        line.len += len;
+}
+
+/*
+ * Appends str as the contents of a JSON string, escaping quotes, backslashes
+ * and control characters. Runs of characters which need no escaping are
+ * copied at once.
+ *
+ */
+static void line_append_escaped(const char *str) {
+        static const char hex[] = "0123456789abcdef";
+        const unsigned char *walk = (const unsigned char *)str;
+
+        while (*walk != '\0') {
+                const unsigned char *start = walk;
+                while (*walk >= 0x20 && *walk != '"' && *walk != '\\')
+                        walk++;
+                line_append((const char *)start, walk - start);
+                if (*walk == '\0')
+                        break;
+
+                line_reserve(6);
+                char *out = line.buf + line.len;
+                switch (*walk) {
+                        case '"':
+                        case '\\':
+                                out[0] = '\\';
+                                out[1] = *walk;
+                                line.len += 2;
+                                break;
+                        case '\n':
+                                memcpy(out, "\\n", 2);
+                                line.len += 2;
+                                break;
+                        case '\t':
+                                memcpy(out, "\\t", 2);
+                                line.len += 2;
+                                break;
+                        default:
+                                memcpy(out, "\\u00", 4);
+                                out[4] = hex[*walk >> 4];
+                                out[5] = hex[*walk & 0xf];
+                                line.len += 6;
+                                break;
+                }
+                walk++;
+        }
+}
+
+/*
+ * Starts a new status line.
+ *
+ */
+void output_line_start(void) {
+        /* Make room for a line as long as the previous one, so that
+         * rendering the blocks does not need to grow the buffer. */
+        size_t previous_len = line.len;
+        line.len = 0;
+        line_reserve(max(previous_len + previous_len / 4, 4096));
+
+        if (output_format == O_TERM) {
+                /* Restore the cursor-position, clear line */
+                line_append("\033[u\033[K", strlen("\033[u\033[K"));
+                return;
+        }
+        if (output_format != O_I3BAR)
+                return;
+
+        /* Lines are elements of one endless array, opened in the header.
+         * The yajl generator is in that array as well, but only ever
+         * generates the blocks (see i3bar_block_close()). */
+        if (first_line)
+                line_append("[", 1);
+        else line_append(",[", 2);
+        first_line = false;
+        first_block = true;
+}
+
+/*
+ * Writes the whole buffer, so that status bars never read a partial line
+ * (unless the line is longer than PIPE_BUF).
+ *
+ */
+static void write_all(const char *buf, size_t len) {
+        while (len > 0) {
+                ssize_t n = write(STDOUT_FILENO, buf, len);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        return;
+                }
+                buf += n;
+                len -= n;
+        }
+}
+
+/*
+ * Finishes the status line and writes it (followed by a newline) to stdout
+ * using a single write(), unless flush is false (in benchmark mode).
+ *
+ */
+void output_line_end(bool flush) {
+        if (output_format == O_I3BAR)
+                line_append("]", 1);
+        line_append("\n", 1);
+        if (flush)
+                write_all(line.buf, line.len);
+}
+
+/*
+ * Returns the number of bytes of the current status line generated so far.
+ *
+ */
+size_t output_line_len(void) {
+        return line.len;
+}
+
+/*
+ * Allocates the output cache for the given number of blocks.
+ *
+ */
+void output_init_blocks(unsigned int num_blocks) {
+        num_block_outputs = num_blocks;
+        if ((block_outputs = calloc(num_blocks, sizeof(struct block_output))) == NULL)
+                die("Error: out of memory (calloc())\n");
+}
+
+/*
+ * Marks the start of the output of a block which is about to be rendered.
+ *
+ */
+void output_block_begin(void) {
+        block_start = line.len;
+}
+
+/*
+ * Saves the output of the block rendered since output_block_begin(), so that
+ * output_block_cached() can repeat it.
+ *
+ */
+void output_block_end(unsigned int block) {
+        struct block_output *out = &block_outputs[block];
+        size_t start = block_start;
+
+        if (output_format == O_I3BAR && start < line.len && line.buf[start] == ',')
+                start++;
+
+        size_t len = line.len - start;
+        if (len > out->size) {
+                if ((out->buf = realloc(out->buf, len)) == NULL)
+                        die("Error: out of memory (realloc(%zd))\n", len);
+                out->size = len;
         }
+        memcpy(out->buf, line.buf + start, len);
+        out->len = len;
+}
+
+/*
+ * Appends the output of the block as it was rendered the last time.
+ *
+ */
+void output_block_cached(unsigned int block) {
+        struct block_output *out = &block_outputs[block];
+
+        if (out->len == 0)
+                return;
+        if (output_format == O_I3BAR) {
+                if (!first_block)
+                        line_append(",", 1);
+                first_block = false;
+        }
+        line_append(out->buf, out->len);
+}
+
+/*
+ * Appends text to the status line (for all formats but i3bar).
+ *
+ */
+void output_text(const char *text) {
+        line_append(text, strlen(text));
+}
+
+void i3bar_block_open(yajl_gen json_gen, const char *name) {
+        if (json_emitter == EMITTER_YAJL) {
+                yajl_gen_map_open(json_gen);
+                i3bar_string(json_gen, KEY_NAME, name);
+                return;
+        }
+
+        /* The name is always the first key, so it is the only one which
+         * does not start with a comma. */
+        if (first_block)
+                line_append("{", 1);
+        else line_append(",{", 2);
+        first_block = false;
+        line_append(i3bar_keys[KEY_NAME].json + 1, i3bar_keys[KEY_NAME].json_len - 1);
+        line_append_escaped(name);
+        line_append("\"", 1);
+}
+
+void i3bar_block_close(yajl_gen json_gen) {
+        if (json_emitter != EMITTER_YAJL) {
+                line_append("}", 1);
+                return;
+        }
+
+        const unsigned char *buf;
+#if YAJL_MAJOR >= 2
+        size_t len;
+#else
+        unsigned int len;
+#endif
+        yajl_gen_map_close(json_gen);
+        yajl_gen_get_buf(json_gen, &buf, &len);
+
+        /* yajl separates the block from the previous one (possibly of a
+         * previous line) with a comma, which we add ourselves. */
+        if (len > 0 && buf[0] == ',') {
+                buf++;
+                len--;
+        }
+        if (!first_block)
+                line_append(",", 1);
+        first_block = false;
+        line_append((const char *)buf, len);
+        yajl_gen_clear(json_gen);
+}
+
+/*
+ * Adds the given key with a string value to the current block.
+ *
+ */
+void i3bar_string(yajl_gen json_gen, enum i3bar_key key, const char *value) {
+        if (json_emitter == EMITTER_YAJL) {
+                yajl_gen_string(json_gen, (const unsigned char *)i3bar_keys[key].json + 2, i3bar_keys[key].key_len);
+                yajl_gen_string(json_gen, (const unsigned char *)value, strlen(value));
+                return;
+        }
+
+        line_append(i3bar_keys[key].json, i3bar_keys[key].json_len);
+        line_append_escaped(value);
+        line_append("\"", 1);
+}
+
+/*
+ * Formats the color escape sequence for dzen (^fg(color)), xmobar
+ * (<fc=color>) or the terminal.
+ *
+ */
+static void format_color(char *buf, size_t size, const char *colorstr) {
+        buf[0] = '\0';
         if (output_format == O_DZEN2)
-                (void)snprintf(colorbuf, sizeof(colorbuf), "^fg(%s)", cfg_getstr(cfg_general, colorstr));
+                (void)snprintf(buf, size, "^fg(%s)", cfg_getstr(cfg_general, colorstr));
         else if (output_format == O_XMOBAR)
-                (void)snprintf(colorbuf, sizeof(colorbuf), "<fc=%s>", cfg_getstr(cfg_general, colorstr));
+                (void)snprintf(buf, size, "<fc=%s>", cfg_getstr(cfg_general, colorstr));
         else if (output_format == O_TERM) {
                 /* The escape-sequence for color is <CSI><col>;1m (bright/bold
                  * output), where col is a 3-bit rgb-value with b in the
@@ -35,8 +371,48 @@ char *color(const char *colorstr) {
                 int g = (col & (0xFF << 8)) / 0x8000;
                 int b = (col & (0xFF << 16)) / 0x800000;
                 col = (r << 2) | (g << 1) | b;
-                (void)snprintf(colorbuf, sizeof(colorbuf), "\033[3%d;1m", col);
+                (void)snprintf(buf, size, "\033[3%d;1m", col);
         }
+}
+
+/*
+ * Precomputes the color escape sequences and the separator for the output
+ * format. Must be called once the config is loaded and the output format is
+ * known.
+ *
+ */
+void init_colors(void) {
+        for (size_t i = 0; i < sizeof(colors) / sizeof(colors[0]); i++)
+                if (cfg_getbool(cfg_general, "colors"))
+                        format_color(colors[i].start, sizeof(colors[i].start), colors[i].name);
+
+        /* The separator is colored even if colors are disabled (except in
+         * the terminal). */
+        if (output_format == O_DZEN2)
+                (void)snprintf(separator, sizeof(separator), "^fg(%s)^p(5;-2)^ro(2)^p()^fg()^p(5)", cfg_getstr(cfg_general, "color_separator"));
+        else if (output_format == O_XMOBAR)
+                (void)snprintf(separator, sizeof(separator), "<fc=%s> | </fc>", cfg_getstr(cfg_general, "color_separator"));
+        else if (output_format == O_TERM)
+                (void)snprintf(separator, sizeof(separator), " %s|%s ", color("color_separator"), endcolor());
+        else if (output_format == O_NONE)
+                (void)snprintf(separator, sizeof(separator), " | ");
+}
+
+/*
+ * Returns the correct color format for dzen (^fg(color)) or xmobar (<fc=color>)
+ *
+ */
+const char *color(const char *colorstr) {
+        static char colorbuf[32];
+
+        for (size_t i = 0; i < sizeof(colors) / sizeof(colors[0]); i++)
+                if (strcmp(colors[i].name, colorstr) == 0)
+                        return colors[i].start;
+
+        /* Not one of the general colors, which is not expected. */
+        colorbuf[0] = '\0';
+        if (cfg_getbool(cfg_general, "colors"))
+                format_color(colorbuf, sizeof(colorbuf), colorstr);
         return colorbuf;
 }
 
@@ -53,14 +429,8 @@ char *endcolor(void) {
 }
 
 void print_seperator(void) {
-        if (output_format == O_DZEN2)
-                printf("^fg(%s)^p(5;-2)^ro(2)^p()^fg()^p(5)", cfg_getstr(cfg_general, "color_separator"));
-        else if (output_format == O_XMOBAR)
-                printf("<fc=%s> | </fc>", cfg_getstr(cfg_general, "color_separator"));
-        else if (output_format == O_TERM)
-                printf(" %s|%s ", color("color_separator"), endcolor());
-        else if (output_format == O_NONE)
-                printf(" | ");
+        if (output_format != O_I3BAR)
+                line_append(separator, strlen(separator));
 }
 
 /*
@@ -8,7 +8,6 @@
 #include <stdio.h>
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_version.h>
-#include <libnotify/notify.h>
 
 #include "i3status.h"
 
@@ -24,8 +23,165 @@
 #include <machine/apmvar.h>
 #endif
 
-static char *prev_status;
-static bool prev_critical = false;
+#include "queue.h"
+
+#if defined(LINUX)
+/* Time constant of the smoothing of the charge/discharge rate, in seconds. */
+#define RATE_SMOOTHING_SECONDS 60
+#endif
+
+/* How many percentage points a battery has to recover above a notification
+ * level before crossing it again sends another notification. */
+#define NOTIFICATION_HYSTERESIS 2
+
+/*
+ * What we remember about a battery between updates: a smoothed rate, so that
+ * the remaining time does not jump around with the instantaneous power draw,
+ * and what notifications were sent.
+ *
+ */
+struct battery_state {
+        char *path;
+        charging_status_t status;
+        /* Exponentially weighted moving average of the rate in µW, or 0 if
+         * unknown. */
+        double rate_avg;
+        double sampled;
+        /* The last ENERGY_NOW or CHARGE_NOW value as reported by the battery
+         * and when it changed, used to derive the rate on batteries which do
+         * not report it. */
+        int level;
+        double level_changed;
+
+        /* The state as of the last notification check. The first update only
+         * initializes it. */
+        bool notified;
+        charging_status_t notified_status;
+        bool notified_critical;
+        /* The lowest notification level which was crossed, or -1. */
+        int notified_level;
+
+        TAILQ_ENTRY(battery_state) batteries;
+};
+
+static TAILQ_HEAD(batteries_head, battery_state) batteries = TAILQ_HEAD_INITIALIZER(batteries);
+
+static struct battery_state *get_battery_state(const char *path) {
+        struct battery_state *bat;
+
+        TAILQ_FOREACH(bat, &batteries, batteries) {
+                if (strcmp(bat->path, path) == 0)
+                        return bat;
+        }
+        if ((bat = calloc(1, sizeof(struct battery_state))) == NULL ||
+            (bat->path = strdup(path)) == NULL)
+                die("Error: out of memory\n");
+        bat->level = -1;
+        bat->notified_level = -1;
+        TAILQ_INSERT_TAIL(&batteries, bat, batteries);
+        return bat;
+}
+
+/*
+ * Returns the lowest notification level the percentage is at or below, or -1
+ * if it is above all of them.
+ *
+ */
+static int lowest_level_reached(const int *levels, int num_levels, float percentage) {
+        int reached = -1;
+
+        for (int i = 0; i < num_levels; i++)
+                if (percentage <= levels[i] && (reached == -1 || levels[i] < reached))
+                        reached = levels[i];
+        return reached;
+}
+
+/*
+ * Decides whether a notification is due, which is the case when the charging
+ * status changed, when the battery became critical or when it discharged
+ * below a notification level it had not crossed yet. A level is only armed
+ * again once the battery recovered NOTIFICATION_HYSTERESIS percentage points
+ * above it. A negative percentage means that it is unknown.
+ *
+ */
+static bool notification_due(struct battery_state *bat, charging_status_t status, bool critical, float percentage, const int *levels, int num_levels) {
+        bool due = false;
+
+        if (!bat->notified) {
+                bat->notified = true;
+                bat->notified_status = status;
+        } else if (status != bat->notified_status) {
+                bat->notified_status = status;
+                due = true;
+        }
+
+        if (critical != bat->notified_critical) {
+                bat->notified_critical = critical;
+                due |= critical;
+        }
+
+        if (percentage < 0)
+                return due;
+
+        int reached = lowest_level_reached(levels, num_levels, percentage);
+        if (status == CS_DISCHARGING && reached != -1 &&
+            (bat->notified_level == -1 || reached < bat->notified_level)) {
+                bat->notified_level = reached;
+                due = true;
+        } else if (bat->notified_level != -1 && percentage > bat->notified_level + NOTIFICATION_HYSTERESIS) {
+                bat->notified_level = lowest_level_reached(levels, num_levels, percentage - NOTIFICATION_HYSTERESIS);
+        }
+
+        return due;
+}
+
+#if defined(LINUX)
+/*
+ * Feeds a new sample into the smoothed rate. The instantaneous rate (in µW)
+ * is used if the battery reports one, otherwise the rate is derived from the
+ * change of the raw level, which is converted to µWh by multiplying it with
+ * level_to_energy. Using the raw level keeps noise of the voltage (used to
+ * convert charge to energy) out of the rate. The average starts over whenever
+ * the battery switches between charging and discharging.
+ *
+ */
+static void update_battery_rate(struct battery_state *bat, charging_status_t status, int present_rate, int level, double level_to_energy) {
+        double now = events_monotonic_seconds();
+        double sample = 0;
+
+        if (status != bat->status) {
+                bat->status = status;
+                bat->rate_avg = 0;
+                bat->level = -1;
+        }
+
+        if (present_rate > 0) {
+                sample = present_rate;
+        } else if (bat->level != -1 && level != bat->level && now > bat->level_changed) {
+                int delta = level - bat->level;
+                /* A change against the charging direction is just noise. */
+                if ((status == CS_CHARGING && delta > 0) || (status == CS_DISCHARGING && delta < 0))
+                        sample = abs(delta) * level_to_energy / ((now - bat->level_changed) / 3600);
+        }
+
+        if (level != bat->level) {
+                bat->level = level;
+                bat->level_changed = now;
+        }
+
+        if (sample > 0) {
+                if (bat->rate_avg <= 0) {
+                        bat->rate_avg = sample;
+                } else {
+                        /* A first-order low-pass filter, i.e. an EWMA whose
+                         * weight depends on the time since the last sample. */
+                        double dt = now - bat->sampled;
+                        bat->rate_avg += (sample - bat->rate_avg) * dt / (RATE_SMOOTHING_SECONDS + dt);
+                }
+        }
+        bat->sampled = now;
+}
+#endif
 
 struct battery_info {
         const char *status;
@@ -89,6 +245,7 @@ void battery_format_string(
 }
 
 void battery_send_notification(
+        const char *source,
         const struct battery_info info,
         const char *header_format,
         const char *body_format
@@ -103,14 +260,7 @@ void battery_send_notification(
         outwalk = body;
         battery_format_string(info, body_format, &outwalk);
 
-        NotifyNotification *battery_notification = notify_notification_new(header, body, "dialog-information");
-
-        if (info.critical == true) {
-                notify_notification_set_urgency(battery_notification, NOTIFY_URGENCY_CRITICAL);
-        }
-
-        notify_notification_show(battery_notification, NULL);
-        g_object_unref(G_OBJECT(battery_notification));
+        send_notification(source, header, body, info.critical);
 }
 
 #define BATT_STATUS_NAME(status) \
@@ -132,13 +282,15 @@ void print_battery_info(
         const char *format_down,
         const char *notif_header_format,
         const char *notif_body_format,
+        const int *notification_levels,
+        int num_notification_levels,
         int low_threshold,
         char *threshold_type,
         bool last_full_capacity,
         bool integer_battery_capacity
 ) {
         time_t empty_time;
-        struct tm *empty_tm;
+        struct tm empty_tm;
 
         char buf[1024];
         char statusbuf[16];
@@ -146,6 +298,9 @@ void print_battery_info(
         char remainingbuf[256];
         char emptytimebuf[256];
         char consumptionbuf[256];
+        char rateavgbuf[16];
+        char healthbuf[16];
+        char cyclesbuf[16];
         bool critical = false;
 
         const char *walk, *last;
@@ -154,27 +309,38 @@ void print_battery_info(
         bool colorful_output = false;
         int full_design = -1,
             remaining = -1,
+            level,
             present_rate = -1,
             voltage = -1;
+        int design = -1,
+            last_full = -1,
+            cycles = -1;
         charging_status_t status = CS_DISCHARGING;
+        /* The percentage as a number, for the notification levels. */
+        float percentage = -1;
 
         memset(statusbuf, '\0', sizeof(statusbuf));
         memset(percentagebuf, '\0', sizeof(percentagebuf));
         memset(remainingbuf, '\0', sizeof(remainingbuf));
         memset(emptytimebuf, '\0', sizeof(emptytimebuf));
         memset(consumptionbuf, '\0', sizeof(consumptionbuf));
+        memset(rateavgbuf, '\0', sizeof(rateavgbuf));
+        memset(healthbuf, '\0', sizeof(healthbuf));
+        memset(cyclesbuf, '\0', sizeof(cyclesbuf));
 
         static char batpath[512];
         sprintf(batpath, path, number);
         INSTANCE(batpath);
 
+        struct battery_state *bat = get_battery_state(batpath);
+
 #if defined(LINUX)
         if (!slurp(batpath, buf, sizeof(buf))) {
                 OUTPUT_FULL_TEXT(format_down);
                 return;
         }
 
-        for (walk = buf, last = buf; (walk-buf) < 1024; walk++) {
+        for (walk = buf, last = buf; *walk != '\0'; walk++) {
                 if (*walk == '\n') {
                         last = walk+1;
                         continue;
@@ -205,26 +371,23 @@ void print_battery_info(
                         status = CS_CHARGING;
                 else if (BEGINS_WITH(last, "POWER_SUPPLY_STATUS=Full"))
                         status = CS_FULL;
-                else {
-                        /* The only thing left is the full capacity */
-                        if (last_full_capacity) {
-                                if (!BEGINS_WITH(last, "POWER_SUPPLY_ENERGY_FULL") &&
-                                    !BEGINS_WITH(last, "POWER_SUPPLY_CHARGE_FULL"))
-                                        continue;
-                        } else {
-                                if (!BEGINS_WITH(last, "POWER_SUPPLY_CHARGE_FULL_DESIGN") &&
-                                    !BEGINS_WITH(last, "POWER_SUPPLY_ENERGY_FULL_DESIGN"))
-                                        continue;
-                        }
-
-                        full_design = atoi(walk+1);
-                }
+                else if (BEGINS_WITH(last, "POWER_SUPPLY_CYCLE_COUNT"))
+                        cycles = atoi(walk+1);
+                else if (BEGINS_WITH(last, "POWER_SUPPLY_CHARGE_FULL_DESIGN") ||
+                         BEGINS_WITH(last, "POWER_SUPPLY_ENERGY_FULL_DESIGN"))
+                        design = atoi(walk+1);
+                else if (BEGINS_WITH(last, "POWER_SUPPLY_CHARGE_FULL") ||
+                         BEGINS_WITH(last, "POWER_SUPPLY_ENERGY_FULL"))
+                        last_full = atoi(walk+1);
         }
 
+        full_design = (last_full_capacity ? last_full : design);
+
         /* the difference between POWER_SUPPLY_ENERGY_NOW and
          * POWER_SUPPLY_CHARGE_NOW is the unit of measurement. The energy is
          * given in mWh, the charge in mAh. So calculate every value given in
          * ampere to watt */
+        level = remaining;
         if (!watt_as_unit) {
             present_rate = (((float)voltage / 1000.0) * ((float)present_rate / 1000.0));
             remaining = (((float)voltage / 1000.0) * ((float)remaining / 1000.0));
@@ -239,19 +402,34 @@ void print_battery_info(
         (void)snprintf(statusbuf, sizeof(statusbuf), "%s", BATT_STATUS_NAME(status));
 
         float percentage_remaining = (((float)remaining / (float)full_design) * 100);
+        percentage = percentage_remaining;
         if (integer_battery_capacity) {
                 (void)snprintf(percentagebuf, sizeof(percentagebuf), "%.00f%%", percentage_remaining);
         } else {
                 (void)snprintf(percentagebuf, sizeof(percentagebuf), "%.02f%%", percentage_remaining);
         }
 
-        if (present_rate > 0) {
+        /* Health is a ratio, so it does not matter whether it is computed
+         * from energy or from charge. */
+        if (design > 0 && last_full > 0)
+                (void)snprintf(healthbuf, sizeof(healthbuf), "%.0f%%", 100.0 * last_full / design);
+        if (cycles >= 0)
+                (void)snprintf(cyclesbuf, sizeof(cyclesbuf), "%d", cycles);
+
+        update_battery_rate(bat, status, present_rate, level,
+                            (watt_as_unit ? 1.0 : voltage / 1000.0 / 1000.0));
+
+        if (present_rate > 0)
+                (void)snprintf(consumptionbuf, sizeof(consumptionbuf), "%1.2fW",
+                        ((float)present_rate / 1000.0 / 1000.0));
+
+        if (bat->rate_avg > 0) {
                 float remaining_time;
                 int seconds, hours, minutes, seconds_remaining;
                 if (status == CS_CHARGING)
-                        remaining_time = ((float)full_design - (float)remaining) / (float)present_rate;
+                        remaining_time = ((float)full_design - (float)remaining) / bat->rate_avg;
                 else if (status == CS_DISCHARGING)
-                        remaining_time = ((float)remaining / (float)present_rate);
+                        remaining_time = ((float)remaining / bat->rate_avg);
                 else remaining_time = 0;
 
                 seconds_remaining = (int)(remaining_time * 3600.0);
@@ -280,13 +458,13 @@ void print_battery_info(
 
                 empty_time = time(NULL);
                 empty_time += seconds_remaining;
-                empty_tm = localtime(&empty_time);
+                localtime_r(&empty_time, &empty_tm);
 
                 (void)snprintf(emptytimebuf, sizeof(emptytimebuf), "%02d:%02d:%02d",
-                        max(empty_tm->tm_hour, 0), max(empty_tm->tm_min, 0), max(empty_tm->tm_sec, 0));
+                        max(empty_tm.tm_hour, 0), max(empty_tm.tm_min, 0), max(empty_tm.tm_sec, 0));
 
-                (void)snprintf(consumptionbuf, sizeof(consumptionbuf), "%1.2fW",
-                        ((float)present_rate / 1000.0 / 1000.0));
+                (void)snprintf(rateavgbuf, sizeof(rateavgbuf), "%1.2fW",
+                        bat->rate_avg / 1000.0 / 1000.0);
         } else {
                 /* On some systems, present_rate may not exist. Still, make sure
                  * we colorize the output if threshold_type is set to percentage
@@ -336,6 +514,7 @@ void print_battery_info(
 
         (void)snprintf(percentagebuf, sizeof(percentagebuf), "%02d%%",
                        present_rate);
+        percentage = present_rate;
 
         if (state == 1) {
                 int hours, minutes;
@@ -397,6 +576,7 @@ void print_battery_info(
 
         (void)snprintf(statusbuf, sizeof(statusbuf), "%s", BATT_STATUS_NAME(status));
         (void)snprintf(percentagebuf, sizeof(percentagebuf), "%02d%%", apm_info.battery_life);
+        percentage = apm_info.battery_life;
 
         if (status == CS_DISCHARGING && low_threshold > 0) {
                 if (strncmp(threshold_type, "percentage", strlen(threshold_type)) == 0
@@ -468,24 +648,24 @@ void print_battery_info(
                         outwalk += sprintf(outwalk, "%s", consumptionbuf);
                         walk += strlen("consumption");
                         EAT_SPACE_FROM_OUTPUT_IF_EMPTY(consumptionbuf);
+                } else if (BEGINS_WITH(walk + 1, "rate_avg")) {
+                        outwalk += sprintf(outwalk, "%s", rateavgbuf);
+                        walk += strlen("rate_avg");
+                        EAT_SPACE_FROM_OUTPUT_IF_EMPTY(rateavgbuf);
+                } else if (BEGINS_WITH(walk + 1, "health")) {
+                        outwalk += sprintf(outwalk, "%s", healthbuf);
+                        walk += strlen("health");
+                        EAT_SPACE_FROM_OUTPUT_IF_EMPTY(healthbuf);
+                } else if (BEGINS_WITH(walk + 1, "cycles")) {
+                        outwalk += sprintf(outwalk, "%s", cyclesbuf);
+                        walk += strlen("cycles");
+                        EAT_SPACE_FROM_OUTPUT_IF_EMPTY(cyclesbuf);
                 }
         }
 
-        if (prev_status != NULL && strcmp(prev_status, info.status) == 0 &&
-                        prev_critical == critical) {
-            goto end;
-        }
-
-        battery_send_notification(info, notif_header_format, notif_body_format);
-
-        free(prev_status);
-        if ((prev_status = (char *)malloc(sizeof(char) * (strlen(info.status) + 1))) == NULL) {
-            goto end;
-        }
-        strcpy(prev_status, info.status);
-        prev_critical = critical;
+        if (notification_due(bat, status, critical, percentage, notification_levels, num_notification_levels))
+                battery_send_notification(batpath, info, notif_header_format, notif_body_format);
 
-end:
         if (colorful_output) { END_COLOR; }
         OUTPUT_FULL_TEXT(buffer);
 }
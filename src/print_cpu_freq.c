@@ -0,0 +1,241 @@
+// vim:ts=8:expandtab
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+
+#if defined(LINUX)
+#include <fcntl.h>
+#include <glob.h>
+#include <unistd.h>
+
+#define POLICY_GLOB "/sys/devices/system/cpu/cpufreq/policy[0-9]*/related_cpus"
+#define CPU_GLOB "/sys/devices/system/cpu/cpu[0-9]*/cpufreq/related_cpus"
+
+/*
+ * A cpufreq policy, i.e. a group of CPUs which always run at the same
+ * frequency. Its files are kept open, so that a policy costs two pread() per
+ * tick no matter how many CPUs it contains.
+ *
+ */
+struct cpu_policy {
+        char *dir;
+        int first_cpu;
+        int num_cpus;
+        int freq_fd;
+        int governor_fd;
+        /* The current frequency, or 0 if it cannot be read. */
+        long khz;
+        char governor[32];
+};
+
+static struct cpu_policy *policies;
+static int num_policies = -1;
+
+/*
+ * Counts the CPUs in a list like "0-3,6" as found in related_cpus (older
+ * kernels separate them by spaces) and returns the first one in *first.
+ *
+ */
+static int parse_cpu_list(const char *list, int *first) {
+        const char *walk = list;
+        char *end;
+        int count = 0;
+
+        *first = -1;
+        while (*walk != '\0') {
+                long from = strtol(walk, &end, 10), to;
+                if (end == walk)
+                        break;
+                to = from;
+                if (*end == '-')
+                        to = strtol(end + 1, &end, 10);
+                if (*first == -1)
+                        *first = from;
+                count += to - from + 1;
+                walk = end + strspn(end, ", \n");
+        }
+        return count;
+}
+
+static int open_cpufreq_file(const struct cpu_policy *policy, const char *name) {
+        char path[256];
+        (void)snprintf(path, sizeof(path), "%s/%s", policy->dir, name);
+        return open_rooted(path, O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * Adds the policies found by globbing for the related_cpus files. With
+ * dedup set, every CPU has its own directory (kernels before 4.3), and only
+ * the first CPU of each group is kept so that shared policies are read once.
+ *
+ */
+static void add_policies(const char *pattern, bool dedup) {
+        glob_t globbuf;
+        char buf[256];
+
+        if (glob_rooted(pattern, 0, &globbuf) != 0) {
+                globfree(&globbuf);
+                return;
+        }
+
+        for (size_t i = 0; i < globbuf.gl_pathc; i++) {
+                char *path = globbuf.gl_pathv[i];
+                int cpu, first, num_cpus;
+
+                if (!slurp(path, buf, sizeof(buf)) || (num_cpus = parse_cpu_list(buf, &first)) == 0)
+                        continue;
+                if (dedup && (sscanf(path, "/sys/devices/system/cpu/cpu%d/", &cpu) != 1 || cpu != first))
+                        continue;
+
+                struct cpu_policy *grown = realloc(policies, sizeof(struct cpu_policy) * (num_policies + 1));
+                if (grown == NULL)
+                        break;
+                policies = grown;
+
+                struct cpu_policy *policy = &policies[num_policies++];
+                *strrchr(path, '/') = '\0';
+                if ((policy->dir = strdup(path)) == NULL)
+                        die("Error: out of memory (strdup())\n");
+                policy->first_cpu = first;
+                policy->num_cpus = num_cpus;
+                policy->freq_fd = open_cpufreq_file(policy, "scaling_cur_freq");
+                policy->governor_fd = open_cpufreq_file(policy, "scaling_governor");
+                policy->khz = 0;
+                policy->governor[0] = '\0';
+        }
+        globfree(&globbuf);
+}
+
+static void enumerate_policies(void) {
+        num_policies = 0;
+        add_policies(POLICY_GLOB, false);
+        if (num_policies == 0)
+                add_policies(CPU_GLOB, true);
+
+        /* glob() sorts lexically (policy10 before policy2), we want policies
+         * in CPU order so that %policyN is stable. */
+        for (int i = 1; i < num_policies; i++)
+                for (int k = i; k > 0 && policies[k - 1].first_cpu > policies[k].first_cpu; k--) {
+                        struct cpu_policy tmp = policies[k];
+                        policies[k] = policies[k - 1];
+                        policies[k - 1] = tmp;
+                }
+}
+
+/*
+ * Reads one of the policy’s files. If the read fails (e.g. because the CPU
+ * was offlined and onlined again), the file is re-opened once.
+ *
+ */
+static bool read_cpufreq_file(const struct cpu_policy *policy, int *fd, const char *name, char *buf, size_t size) {
+        ssize_t n;
+
+        if (*fd == -1 || (n = pread(*fd, buf, size - 1, 0)) <= 0) {
+                if (*fd != -1)
+                        (void)close(*fd);
+                if ((*fd = open_cpufreq_file(policy, name)) == -1 ||
+                    (n = pread(*fd, buf, size - 1, 0)) <= 0)
+                        return false;
+        }
+        buf[n] = '\0';
+        return true;
+}
+
+static void update_policy(struct cpu_policy *policy) {
+        char buf[32];
+
+        if (read_cpufreq_file(policy, &policy->freq_fd, "scaling_cur_freq", buf, sizeof(buf)))
+                policy->khz = strtol(buf, NULL, 10);
+        else policy->khz = 0;
+
+        if (read_cpufreq_file(policy, &policy->governor_fd, "scaling_governor", buf, sizeof(buf))) {
+                buf[strcspn(buf, "\n")] = '\0';
+                (void)snprintf(policy->governor, sizeof(policy->governor), "%s", buf);
+        } else policy->governor[0] = '\0';
+}
+
+/*
+ * Prints a frequency given in kHz.
+ *
+ */
+static int print_freq(char *outwalk, long khz) {
+        if (khz >= 1000000)
+                return sprintf(outwalk, "%.2f GHz", khz / 1e6);
+        return sprintf(outwalk, "%ld MHz", khz / 1000);
+}
+#endif
+
+/*
+ * Reads the current frequency and governor of all cpufreq policies from
+ * /sys/devices/system/cpu/cpufreq. %avg is weighted by the number of CPUs in
+ * each policy.
+ *
+ */
+void print_cpu_freq(yajl_gen json_gen, char *buffer, const char *format) {
+#if defined(LINUX)
+        const char *walk;
+        char *outwalk = buffer;
+        long long weighted_khz = 0;
+        long max_khz = 0;
+        int num_cpus = 0;
+
+        if (num_policies == -1)
+                enumerate_policies();
+        if (num_policies == 0)
+                goto error;
+
+        for (int i = 0; i < num_policies; i++) {
+                update_policy(&policies[i]);
+                /* Policies whose frequency cannot be read (e.g. because all
+                 * their CPUs are offline) are left out. */
+                if (policies[i].khz <= 0)
+                        continue;
+                weighted_khz += (long long)policies[i].khz * policies[i].num_cpus;
+                num_cpus += policies[i].num_cpus;
+                max_khz = max(max_khz, policies[i].khz);
+        }
+
+        for (walk = format; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+
+                if (BEGINS_WITH(walk+1, "avg")) {
+                        if (num_cpus > 0)
+                                outwalk += print_freq(outwalk, weighted_khz / num_cpus);
+                        else outwalk += sprintf(outwalk, "?");
+                        walk += strlen("avg");
+                } else if (BEGINS_WITH(walk+1, "max")) {
+                        if (num_cpus > 0)
+                                outwalk += print_freq(outwalk, max_khz);
+                        else outwalk += sprintf(outwalk, "?");
+                        walk += strlen("max");
+                } else if (BEGINS_WITH(walk+1, "governor")) {
+                        outwalk += sprintf(outwalk, "%s", policies[0].governor);
+                        walk += strlen("governor");
+                } else if (BEGINS_WITH(walk+1, "policy")) {
+                        char *end;
+                        long idx = strtol(walk + 1 + strlen("policy"), &end, 10);
+                        if (end == walk + 1 + strlen("policy")) {
+                                *(outwalk++) = '%';
+                                continue;
+                        }
+                        if (idx >= 0 && idx < num_policies && policies[idx].khz > 0)
+                                outwalk += print_freq(outwalk, policies[idx].khz);
+                        else outwalk += sprintf(outwalk, "?");
+                        walk = end - 1;
+                }
+        }
+
+        OUTPUT_FULL_TEXT(buffer);
+        return;
+error:
+#endif
+        OUTPUT_FULL_TEXT("cant read cpu frequency");
+        stats_error("Cannot read CPU frequency. Verify that /sys/devices/system/cpu/cpufreq exists or disable the cpu_freq module in your i3status config.");
+}
@@ -37,55 +37,319 @@
 #endif
 
 
-static char *thermal_zone;
+#if defined(LINUX)
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <unistd.h>
+
+#include "queue.h"
+
+/*
+ * A temperature sensor file in sysfs. The file descriptor is kept open for
+ * the whole lifetime of i3status, so that reading a sensor costs a single
+ * pread() per tick.
+ *
+ */
+struct sensor {
+        char *path;
+        int fd;
+
+        TAILQ_ENTRY(sensor) sensors;
+};
+
+/*
+ * The state of one cpu_temperature block: the (expanded) path pattern it was
+ * configured with and the sensors matching that pattern. As long as the
+ * pattern matches nothing, it is matched again on every update, since drivers
+ * may be loaded later on. Otherwise, it is only matched again when the number
+ * of unreadable sensors changed (hwmon devices may have been renumbered), so
+ * that a sensor which is permanently unreadable does not cost a glob() on
+ * every update.
+ *
+ */
+struct temperature_block {
+        char *pattern;
+        int num_sensors;
+        struct sensor **sensors;
+        int unreadable;
+        bool rescan;
+
+        TAILQ_ENTRY(temperature_block) blocks;
+};
+
+static TAILQ_HEAD(sensors_head, sensor) sensors = TAILQ_HEAD_INITIALIZER(sensors);
+static TAILQ_HEAD(blocks_head, temperature_block) blocks = TAILQ_HEAD_INITIALIZER(blocks);
+static bool sensors_enumerated = false;
+
+/*
+ * Returns the sensor for the given path, opening and adding it to the
+ * registry if it is not known yet. Returns NULL if the file cannot be opened.
+ *
+ */
+static struct sensor *get_sensor(const char *path) {
+        struct sensor *sensor;
+        int fd;
+
+        TAILQ_FOREACH(sensor, &sensors, sensors)
+                if (strcmp(sensor->path, path) == 0)
+                        return sensor;
+
+        if ((fd = open_rooted(path, O_RDONLY | O_CLOEXEC)) == -1)
+                return NULL;
+
+        if ((sensor = calloc(1, sizeof(struct sensor))) == NULL ||
+            (sensor->path = strdup(path)) == NULL) {
+                free(sensor);
+                (void)close(fd);
+                return NULL;
+        }
+        sensor->fd = fd;
+        TAILQ_INSERT_TAIL(&sensors, sensor, sensors);
+        return sensor;
+}
+
+/*
+ * Adds every file matching the given glob pattern to the sensor registry.
+ *
+ */
+static void add_sensors(const char *pattern) {
+        glob_t globbuf;
+
+        if (glob_rooted(pattern, 0, &globbuf) == 0)
+                for (size_t i = 0; i < globbuf.gl_pathc; i++)
+                        (void)get_sensor(globbuf.gl_pathv[i]);
+        globfree(&globbuf);
+}
+
+/*
+ * Enumerates all thermal zones and hwmon temperature inputs. This happens
+ * only once, all blocks then pick their sensors from the registry.
+ *
+ */
+static void enumerate_sensors(void) {
+        if (sensors_enumerated)
+                return;
+        sensors_enumerated = true;
+
+        add_sensors("/sys/class/thermal/thermal_zone*/temp");
+        add_sensors("/sys/class/hwmon/hwmon*/temp*_input");
+}
+
+static void add_to_block(struct temperature_block *block, struct sensor *sensor) {
+        struct sensor **grown = realloc(block->sensors, sizeof(struct sensor *) * (block->num_sensors + 1));
+        if (grown == NULL)
+                return;
+        block->sensors = grown;
+        block->sensors[block->num_sensors++] = sensor;
+}
+
+/*
+ * Closes and removes all sensors from the registry which are not used by any
+ * block (anymore).
+ *
+ */
+static void prune_sensors(void) {
+        struct sensor *sensor, *next;
+        struct temperature_block *block;
+
+        for (sensor = TAILQ_FIRST(&sensors); sensor != NULL; sensor = next) {
+                next = TAILQ_NEXT(sensor, sensors);
+
+                bool used = false;
+                TAILQ_FOREACH(block, &blocks, blocks)
+                        for (int i = 0; !used && i < block->num_sensors; i++)
+                                used = (block->sensors[i] == sensor);
+                if (used)
+                        continue;
+
+                TAILQ_REMOVE(&sensors, sensor, sensors);
+                if (sensor->fd != -1)
+                        (void)close(sensor->fd);
+                free(sensor->path);
+                free(sensor);
+        }
+}
+
+/*
+ * Replaces the block's sensors with the files currently matching its pattern.
+ *
+ */
+static void rescan_block(struct temperature_block *block) {
+        glob_t globbuf;
+        struct sensor *sensor;
+
+        block->num_sensors = 0;
+        block->rescan = false;
+        if (glob_rooted(block->pattern, 0, &globbuf) == 0)
+                for (size_t i = 0; i < globbuf.gl_pathc; i++)
+                        if ((sensor = get_sensor(globbuf.gl_pathv[i])) != NULL)
+                                add_to_block(block, sensor);
+        globfree(&globbuf);
+
+        prune_sensors();
+}
+
+/*
+ * Returns the block state for the given pattern. On first use, the pattern is
+ * matched against the sensor registry. Paths outside of the enumerated
+ * directories (like /sys/devices/platform/coretemp.0/temp1_input) are
+ * resolved using glob() and added to the registry.
+ *
+ */
+static struct temperature_block *get_block(const char *pattern) {
+        struct temperature_block *block;
+        struct sensor *sensor;
+
+        TAILQ_FOREACH(block, &blocks, blocks)
+                if (strcmp(block->pattern, pattern) == 0)
+                        return block;
+
+        enumerate_sensors();
+
+        bool found = false;
+        TAILQ_FOREACH(sensor, &sensors, sensors)
+                if (fnmatch(pattern, sensor->path, FNM_PATHNAME) == 0) {
+                        found = true;
+                        break;
+                }
+        if (!found)
+                add_sensors(pattern);
+
+        if ((block = calloc(1, sizeof(struct temperature_block))) == NULL ||
+            (block->pattern = strdup(pattern)) == NULL) {
+                free(block);
+                return NULL;
+        }
+
+        TAILQ_FOREACH(sensor, &sensors, sensors)
+                if (fnmatch(pattern, sensor->path, FNM_PATHNAME) == 0)
+                        add_to_block(block, sensor);
+
+        TAILQ_INSERT_TAIL(&blocks, block, blocks);
+        return block;
+}
+
+/*
+ * Reads the temperature (in millidegrees celsius) of the given sensor. If the
+ * read fails (for example because the driver was reloaded), the file is
+ * re-opened once.
+ *
+ */
+static bool read_sensor(struct sensor *sensor, long *temp) {
+        char buf[16];
+        ssize_t n;
+
+        if (sensor->fd == -1 ||
+            (n = pread(sensor->fd, buf, sizeof(buf) - 1, 0)) <= 0) {
+                if (sensor->fd != -1)
+                        (void)close(sensor->fd);
+                if ((sensor->fd = open_rooted(sensor->path, O_RDONLY | O_CLOEXEC)) == -1 ||
+                    (n = pread(sensor->fd, buf, sizeof(buf) - 1, 0)) <= 0)
+                        return false;
+        }
+        buf[n] = '\0';
+
+        *temp = strtol(buf, NULL, 10);
+        return (*temp != LONG_MIN && *temp != LONG_MAX && *temp > 0);
+}
+
+/*
+ * Prints the given temperature (in degrees celsius), colored if it exceeds
+ * max_threshold.
+ *
+ */
+#define PRINT_TEMPERATURE(fmt, value) \
+        do { \
+                if ((value) >= max_threshold) { \
+                        START_COLOR("color_bad"); \
+                        colorful_output = true; \
+                } \
+                outwalk += sprintf(outwalk, fmt, (value)); \
+                if (colorful_output) { \
+                        END_COLOR; \
+                        colorful_output = false; \
+                } \
+        } while (0)
+#endif
 
 /*
  * Reads the CPU temperature from /sys/class/thermal/thermal_zone0/temp and
  * returns the temperature in degree celcius.
  *
+ * On Linux, the path may be a glob pattern matching multiple sensors, in
+ * which case %max and %avg aggregate over all of them.
+ *
  */
 void print_cpu_temperature_info(yajl_gen json_gen, char *buffer, int zone, const char *path, const char *format, int max_threshold) {
         char *outwalk = buffer;
 #ifdef THERMAL_ZONE
         const char *walk;
         bool colorful_output = false;
+        char zone_path[512];
 
-        if (thermal_zone == NULL) {
-                if (path == NULL)
-                        asprintf(&thermal_zone, THERMAL_ZONE, zone);
-                else
-                        asprintf(&thermal_zone, path, zone);
-        }
-        path = thermal_zone;
+        (void)snprintf(zone_path, sizeof(zone_path), (path == NULL ? THERMAL_ZONE : path), zone);
+        path = zone_path;
 
         INSTANCE(path);
 
+#if defined(LINUX)
+        struct temperature_block *block = get_block(path);
+        long temp, first = 0, max_temp = 0, sum = 0;
+        int valid = 0;
+
+        if (block == NULL)
+                goto error;
+        if (block->rescan || block->num_sensors == 0)
+                rescan_block(block);
+        if (block->num_sensors == 0)
+                goto error;
+
+        /* Read every sensor exactly once, no matter how often it is
+         * referenced in the format string. */
+        for (int i = 0; i < block->num_sensors; i++) {
+                if (!read_sensor(block->sensors[i], &temp))
+                        continue;
+                if (valid == 0 || temp > max_temp)
+                        max_temp = temp;
+                if (valid == 0)
+                        first = temp;
+                sum += temp;
+                valid++;
+        }
+        if (block->num_sensors - valid != block->unreadable) {
+                block->unreadable = block->num_sensors - valid;
+                block->rescan = true;
+        }
+#endif
+
         for (walk = format; *walk != '\0'; walk++) {
                 if (*walk != '%') {
                         *(outwalk++) = *walk;
                         continue;
                 }
 
+#if defined(LINUX)
+                if (BEGINS_WITH(walk+1, "max")) {
+                        if (valid == 0)
+                                *(outwalk++) = '?';
+                        else PRINT_TEMPERATURE("%ld", max_temp / 1000);
+                        walk += strlen("max");
+                        continue;
+                } else if (BEGINS_WITH(walk+1, "avg")) {
+                        if (valid == 0)
+                                *(outwalk++) = '?';
+                        else PRINT_TEMPERATURE("%ld", sum / valid / 1000);
+                        walk += strlen("avg");
+                        continue;
+                }
+#endif
+
                 if (BEGINS_WITH(walk+1, "degrees")) {
 #if defined(LINUX)
-                        static char buf[16];
-                        long int temp;
-                        if (!slurp(path, buf, sizeof(buf)))
-                                goto error;
-                        temp = strtol(buf, NULL, 10);
-                        if (temp == LONG_MIN || temp == LONG_MAX || temp <= 0)
+                        if (valid == 0)
                                 *(outwalk++) = '?';
-                        else {
-                                if ((temp/1000) >= max_threshold) {
-                                        START_COLOR("color_bad");
-                                        colorful_output = true;
-                                }
-                                outwalk += sprintf(outwalk, "%ld", (temp/1000));
-                                if (colorful_output) {
-                                        END_COLOR;
-                                        colorful_output = false;
-                                }
-                        }
+                        else PRINT_TEMPERATURE("%ld", first / 1000);
 #elif defined(__FreeBSD__) || defined(__FreeBSD_kernel__) || defined(__DragonFly__)
                         int sysctl_rslt;
                         size_t sysctl_size = sizeof(sysctl_rslt);
@@ -235,5 +499,5 @@ error_netbsd1:
 error:
 #endif
         OUTPUT_FULL_TEXT("cant read temp");
-        (void)fputs("i3status: Cannot read temperature. Verify that you have a thermal zone in /sys/class/thermal or disable the cpu_temperature module in your i3status config.\n", stderr);
+        stats_error("Cannot read temperature. Verify that you have a thermal zone in /sys/class/thermal or disable the cpu_temperature module in your i3status config.");
 }
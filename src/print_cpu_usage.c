@@ -107,5 +107,5 @@ void print_cpu_usage(yajl_gen json_gen, char *buffer, const char *format) {
         return;
 error:
         OUTPUT_FULL_TEXT("cant read cpu usage");
-        (void)fputs("i3status: Cannot read CPU usage\n", stderr);
+        stats_error("Cannot read CPU usage");
 }
@@ -207,16 +207,28 @@ struct disc_time *get_ddate(struct tm *current_tm) {
 void print_ddate(yajl_gen json_gen, char *buffer, const char *format, time_t t) {
         char *outwalk = buffer;
         static char *form = NULL;
+        /* The date only changes once a day, so the rendered string is kept
+         * until the day (or the format) changes. */
+        static char cached[4096];
+        static int cached_year = -1, cached_yday = -1;
         struct tm current_tm;
         struct disc_time *dt;
         set_timezone(NULL);  /* Use local time. */
         localtime_r(&t, &current_tm);
+        if (form != NULL && strcmp(form, format) == 0 &&
+            current_tm.tm_year == cached_year && current_tm.tm_yday == cached_yday) {
+                OUTPUT_FULL_TEXT(cached);
+                return;
+        }
         if ((dt = get_ddate(&current_tm)) == NULL)
                 return;
-        if (form == NULL)
-                if ((form = malloc(strlen(format) + 1)) == NULL)
-                        return;
-        strcpy(form, format);
+        free(form);
+        if ((form = strdup(format)) == NULL)
+                return;
         outwalk += format_output(outwalk, form, dt);
+        *outwalk = '\0';
+        strncpy(cached, buffer, sizeof(cached) - 1);
+        cached_year = current_tm.tm_year;
+        cached_yday = current_tm.tm_yday;
         OUTPUT_FULL_TEXT(buffer);
 }
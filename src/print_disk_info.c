@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <stdint.h>
 #include <sys/statvfs.h>
 #include <sys/types.h>
@@ -42,7 +43,7 @@ static int format_bytes(char *outwalk, uint64_t bytes, uint64_t base, const char
  * Prints the given amount of bytes in a human readable manner.
  *
  */
-static int print_bytes_human(char *outwalk, uint64_t bytes, const char *prefix_type) {
+int print_bytes_human(char *outwalk, uint64_t bytes, const char *prefix_type) {
         if (strncmp(prefix_type, "decimal", strlen(prefix_type)) == 0) {
                 return format_bytes(outwalk, bytes, DECIMAL_BASE, si_symbols);
         } else if (strncmp(prefix_type, "custom", strlen(prefix_type)) == 0) {
@@ -66,13 +67,17 @@ void print_disk_info(yajl_gen json_gen, char *buffer, const char *path, const ch
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__) || defined(__OpenBSD__) || defined(__DragonFly__)
         struct statfs buf;
 
-        if (statfs(path, &buf) == -1)
+        if (statfs(path, &buf) == -1) {
+                stats_error("statfs(%s): %s", path, strerror(errno));
                 return;
+        }
 #else
         struct statvfs buf;
 
-        if (statvfs(path, &buf) == -1)
+        if (statvfs(path, &buf) == -1) {
+                stats_error("statvfs(%s): %s", path, strerror(errno));
                 return;
+        }
 #endif
 
         for (walk = format; *walk != '\0'; walk++) {
@@ -0,0 +1,288 @@
+// vim:ts=8:expandtab
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+
+#if defined(LINUX)
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Size of the device hash table, must be a power of two. */
+#define DEVICE_SLOTS 64
+/* /proc/diskstats always counts in 512 byte sectors. */
+#define SECTOR_SIZE 512
+
+/* The counters we need, in the order of the /proc/diskstats columns after
+ * the device name. Columns not listed here are skipped. */
+enum diskstats_field {
+        READS_COMPLETED,
+        SECTORS_READ,
+        WRITES_COMPLETED,
+        SECTORS_WRITTEN,
+        IO_TICKS,
+        DISKSTATS_FIELDS
+};
+
+static const int field_columns[DISKSTATS_FIELDS] = {
+        [READS_COMPLETED] = 0,
+        [SECTORS_READ] = 2,
+        [WRITES_COMPLETED] = 4,
+        [SECTORS_WRITTEN] = 6,
+        [IO_TICKS] = 9,
+};
+
+/*
+ * A device shown by a disk_io block. The counters of the previous parse are
+ * kept to compute the rates.
+ *
+ */
+struct disk_device {
+        char *name;
+        uint64_t counters[DISKSTATS_FIELDS];
+        double sampled_at;
+        bool sampled;
+        /* Whether the device was found in the last parse. */
+        bool present;
+
+        double read_bps, write_bps;
+        double read_iops, write_iops;
+        double util;
+};
+
+static struct disk_device *devices[DEVICE_SLOTS];
+static int num_devices = 0;
+
+static int diskstats_fd = -1;
+static char *diskstats_buf;
+static size_t diskstats_size = 4096;
+/* The tick in which /proc/diskstats was last parsed. */
+static unsigned long parsed_tick = (unsigned long)-1;
+
+/*
+ * FNV-1a of a device name, which ends at the first whitespace.
+ *
+ */
+static uint32_t hash_name(const char *name, size_t *len) {
+        uint32_t hash = 2166136261u;
+        size_t i;
+
+        for (i = 0; name[i] != '\0' && name[i] != ' ' && name[i] != '\n'; i++)
+                hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+        *len = i;
+        return hash;
+}
+
+/*
+ * Returns the slot of the device with the given name, or the empty slot where
+ * it would be inserted. The length of the name is stored in len.
+ *
+ */
+static struct disk_device **lookup_slot(const char *name, size_t *len) {
+        uint32_t slot = hash_name(name, len) & (DEVICE_SLOTS - 1);
+
+        for (; devices[slot] != NULL; slot = (slot + 1) & (DEVICE_SLOTS - 1))
+                if (strncmp(devices[slot]->name, name, *len) == 0 && devices[slot]->name[*len] == '\0')
+                        break;
+        return &devices[slot];
+}
+
+static struct disk_device *get_device(const char *name) {
+        size_t len;
+        struct disk_device **slot = lookup_slot(name, &len);
+
+        if (*slot != NULL)
+                return *slot;
+        /* Keep one slot free so that lookups of unknown names terminate. */
+        if (num_devices == DEVICE_SLOTS - 1)
+                die("Too many disk_io devices (max %d)\n", DEVICE_SLOTS - 1);
+        if ((*slot = calloc(1, sizeof(struct disk_device))) == NULL ||
+            ((*slot)->name = strdup(name)) == NULL)
+                die("Error: out of memory\n");
+        num_devices++;
+        /* Parse again so that the new device has a first sample. */
+        parsed_tick = (unsigned long)-1;
+        return *slot;
+}
+
+/*
+ * Reads /proc/diskstats (kept open) into diskstats_buf, growing the buffer
+ * until the whole file fits. Returns false on error.
+ *
+ */
+static bool read_diskstats(void) {
+        ssize_t n;
+
+        if (diskstats_fd == -1 && (diskstats_fd = open_rooted("/proc/diskstats", O_RDONLY | O_CLOEXEC)) == -1)
+                return false;
+
+        while (true) {
+                if (diskstats_buf == NULL && (diskstats_buf = malloc(diskstats_size)) == NULL)
+                        die("Error: out of memory (malloc())\n");
+                if ((n = pread(diskstats_fd, diskstats_buf, diskstats_size - 1, 0)) <= 0)
+                        return false;
+                if ((size_t)n < diskstats_size - 1)
+                        break;
+                free(diskstats_buf);
+                diskstats_buf = NULL;
+                diskstats_size *= 2;
+        }
+        diskstats_buf[n] = '\0';
+        return true;
+}
+
+static double rate(uint64_t current, uint64_t previous, double seconds) {
+        /* Counters reset when a device is removed and added again. */
+        return (current >= previous ? (current - previous) / seconds : 0);
+}
+
+/*
+ * Updates the sample and the rates of the device from its diskstats line,
+ * starting at the first column after the device name.
+ *
+ */
+static void update_device(struct disk_device *device, const char *walk, double now) {
+        uint64_t counters[DISKSTATS_FIELDS];
+        int field = 0;
+
+        for (int column = 0; field < DISKSTATS_FIELDS && *walk != '\n' && *walk != '\0'; column++) {
+                uint64_t value = 0;
+                while (*walk == ' ')
+                        walk++;
+                for (; *walk >= '0' && *walk <= '9'; walk++)
+                        value = value * 10 + (*walk - '0');
+                if (column == field_columns[field])
+                        counters[field++] = value;
+        }
+        if (field < DISKSTATS_FIELDS)
+                return;
+
+        double seconds = now - device->sampled_at;
+        if (device->sampled && seconds > 0) {
+                device->read_bps = rate(counters[SECTORS_READ], device->counters[SECTORS_READ], seconds) * SECTOR_SIZE;
+                device->write_bps = rate(counters[SECTORS_WRITTEN], device->counters[SECTORS_WRITTEN], seconds) * SECTOR_SIZE;
+                device->read_iops = rate(counters[READS_COMPLETED], device->counters[READS_COMPLETED], seconds);
+                device->write_iops = rate(counters[WRITES_COMPLETED], device->counters[WRITES_COMPLETED], seconds);
+                /* io_ticks counts the milliseconds in which I/O was in
+                 * flight, so 1000 per second means 100%. */
+                device->util = rate(counters[IO_TICKS], device->counters[IO_TICKS], seconds) / 10;
+                if (device->util > 100)
+                        device->util = 100;
+        }
+        memcpy(device->counters, counters, sizeof(counters));
+        device->sampled_at = now;
+        device->sampled = true;
+        device->present = true;
+}
+
+/*
+ * Parses /proc/diskstats in a single pass. Lines of devices no block is
+ * interested in are skipped after hashing their name, so their counters are
+ * never converted.
+ *
+ */
+static bool parse_diskstats(void) {
+        char *next;
+        double now;
+
+        if (!read_diskstats())
+                return false;
+        now = events_monotonic_seconds();
+
+        for (int i = 0; i < DEVICE_SLOTS; i++)
+                if (devices[i] != NULL)
+                        devices[i]->present = false;
+
+        for (char *line = diskstats_buf; *line != '\0'; line = next) {
+                char *walk = line;
+                size_t len;
+
+                if ((next = strchr(line, '\n')) != NULL)
+                        next++;
+                else next = line + strlen(line);
+
+                /* Skip the major and minor number. */
+                for (int column = 0; column < 2; column++) {
+                        while (*walk == ' ')
+                                walk++;
+                        while (*walk >= '0' && *walk <= '9')
+                                walk++;
+                }
+                while (*walk == ' ')
+                        walk++;
+                if (*walk == '\0' || *walk == '\n')
+                        continue;
+
+                struct disk_device *device = *lookup_slot(walk, &len);
+                if (device == NULL)
+                        continue;
+                update_device(device, walk + len, now);
+        }
+        return true;
+}
+#endif
+
+/*
+ * Shows the throughput, IOPS and utilisation of a block device, computed from
+ * the /proc/diskstats counters since the previous update. The file is parsed
+ * once per tick for all disk_io blocks.
+ *
+ */
+void print_disk_io(yajl_gen json_gen, char *buffer, const char *device_name, const char *format, const char *format_down, const char *prefix_type) {
+        char *outwalk = buffer;
+
+        INSTANCE(device_name);
+
+#if defined(LINUX)
+        struct disk_device *device = get_device(device_name);
+        const char *walk;
+
+        if (parsed_tick != stats_ticks()) {
+                if (!parse_diskstats())
+                        goto error;
+                parsed_tick = stats_ticks();
+        }
+
+        if (!device->present)
+                format = format_down;
+
+        for (walk = format; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+
+                if (BEGINS_WITH(walk+1, "device")) {
+                        outwalk += sprintf(outwalk, "%s", device_name);
+                        walk += strlen("device");
+                } else if (BEGINS_WITH(walk+1, "read_iops")) {
+                        outwalk += sprintf(outwalk, "%.0f", device->read_iops);
+                        walk += strlen("read_iops");
+                } else if (BEGINS_WITH(walk+1, "write_iops")) {
+                        outwalk += sprintf(outwalk, "%.0f", device->write_iops);
+                        walk += strlen("write_iops");
+                } else if (BEGINS_WITH(walk+1, "read")) {
+                        outwalk += print_bytes_human(outwalk, device->read_bps, prefix_type);
+                        walk += strlen("read");
+                } else if (BEGINS_WITH(walk+1, "write")) {
+                        outwalk += print_bytes_human(outwalk, device->write_bps, prefix_type);
+                        walk += strlen("write");
+                } else if (BEGINS_WITH(walk+1, "util")) {
+                        outwalk += sprintf(outwalk, "%.0f%%", device->util);
+                        walk += strlen("util");
+                }
+        }
+
+        *outwalk = '\0';
+        OUTPUT_FULL_TEXT(buffer);
+        return;
+error:
+#endif
+        OUTPUT_FULL_TEXT("cant read diskstats");
+        stats_error("Cannot read /proc/diskstats");
+}
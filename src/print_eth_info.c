@@ -14,9 +14,65 @@
 #include "i3status.h"
 
 #if defined(LINUX)
-#include <linux/ethtool.h>
-#include <linux/sockios.h>
-#define PART_ETHSPEED  "E: %s (%d Mbit/s)"
+#include <stdlib.h>
+
+#include "queue.h"
+
+/*
+ * The link speed and duplex of an interface as read from sysfs, valid as long
+ * as the ifstate generation did not change.
+ *
+ */
+struct eth_link {
+        char *interface;
+        unsigned long generation;
+        int speed;
+        char duplex[16];
+
+        TAILQ_ENTRY(eth_link) links;
+};
+
+static TAILQ_HEAD(links_head, eth_link) links = TAILQ_HEAD_INITIALIZER(links);
+
+/*
+ * Returns the link state of the interface, reading /sys/class/net/<interface>/
+ * speed and duplex again only after a link change. Unlike the ETHTOOL_GSET
+ * ioctl, this does not need any privileges.
+ *
+ */
+static struct eth_link *get_eth_link(const char *interface) {
+        struct eth_link *link;
+        unsigned long generation = ifstate_generation();
+        char path[128], buf[32];
+
+        TAILQ_FOREACH(link, &links, links) {
+                if (strcmp(link->interface, interface) == 0)
+                        break;
+        }
+        if (link == NULL) {
+                if ((link = calloc(1, sizeof(struct eth_link))) == NULL ||
+                    (link->interface = strdup(interface)) == NULL)
+                        die("Error: out of memory\n");
+                TAILQ_INSERT_TAIL(&links, link, links);
+        } else if (link->generation == generation)
+                return link;
+
+        link->generation = generation;
+
+        /* Reading speed fails with EINVAL while the link is down, and
+         * some drivers report -1 (SPEED_UNKNOWN). */
+        (void)snprintf(path, sizeof(path), "/sys/class/net/%s/speed", interface);
+        link->speed = (slurp(path, buf, sizeof(buf)) ? atoi(buf) : 0);
+        if (link->speed < 0)
+                link->speed = 0;
+
+        (void)snprintf(path, sizeof(path), "/sys/class/net/%s/duplex", interface);
+        if (!slurp(path, buf, sizeof(buf)))
+                buf[0] = '\0';
+        buf[strcspn(buf, "\n")] = '\0';
+        (void)snprintf(link->duplex, sizeof(link->duplex), "%s", (buf[0] != '\0' && strcmp(buf, "unknown") != 0 ? buf : "?"));
+        return link;
+}
 #endif
 
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__) || defined(__DragonFly__)
@@ -32,21 +88,18 @@
 #include <net/if_media.h>
 #endif
 
-static int print_eth_speed(char *outwalk, const char *interface) {
+struct eth_link;
+
+/*
+ * Prints the link speed. On Linux, link is the interface’s link state, so
+ * that it is fetched only once per update for %speed and %duplex.
+ *
+ */
+static int print_eth_speed(char *outwalk, const char *interface, struct eth_link *link) {
 #if defined(LINUX)
-        /* This code path requires root privileges */
-        int ethspeed = 0;
-        struct ifreq ifr;
-        struct ethtool_cmd ecmd;
-
-        ecmd.cmd = ETHTOOL_GSET;
-        (void)memset(&ifr, 0, sizeof(ifr));
-        ifr.ifr_data = (caddr_t)&ecmd;
-        (void)strcpy(ifr.ifr_name, interface);
-        if (ioctl(general_socket, SIOCETHTOOL, &ifr) == 0) {
-                ethspeed = (ecmd.speed == USHRT_MAX ? 0 : ecmd.speed);
-                return sprintf(outwalk, "%d Mbit/s", ethspeed);
-        } else return sprintf(outwalk, "?");
+        if (link->speed > 0)
+                return sprintf(outwalk, "%d Mbit/s", link->speed);
+        return sprintf(outwalk, "?");
 #elif defined(__FreeBSD__) || defined(__FreeBSD_kernel__) || defined(__DragonFly__)
         char *ethspeed;
         struct ifmediareq ifm;
@@ -112,12 +165,13 @@ static int print_eth_speed(char *outwalk, const char *interface) {
  */
 void print_eth_info(yajl_gen json_gen, char *buffer, const char *interface, const char *format_up, const char *format_down) {
         const char *walk;
-        const char *ip_address = get_ip_addr(interface);
+        const struct if_addrs *addrs = get_if_addrs(interface);
+        struct eth_link *link = NULL;
         char *outwalk = buffer;
 
         INSTANCE(interface);
 
-        if (ip_address == NULL) {
+        if (addrs == NULL) {
                 START_COLOR("color_bad");
                 outwalk += sprintf(outwalk, "%s", format_down);
                 goto out;
@@ -131,12 +185,34 @@ void print_eth_info(yajl_gen json_gen, char *buffer, const char *interface, cons
                         continue;
                 }
 
-                if (strncmp(walk+1, "ip", strlen("ip")) == 0) {
-                        outwalk += sprintf(outwalk, "%s", ip_address);
+                if (BEGINS_WITH(walk+1, "ip4")) {
+                        outwalk += print_ip_addrs(outwalk, addrs, AF_INET);
+                        walk += strlen("ip4");
+                } else if (BEGINS_WITH(walk+1, "ip6")) {
+                        outwalk += print_ip_addrs(outwalk, addrs, AF_INET6);
+                        walk += strlen("ip6");
+                } else if (BEGINS_WITH(walk+1, "cidr")) {
+                        outwalk += print_ip_addr(outwalk, addrs, true);
+                        walk += strlen("cidr");
+                } else if (BEGINS_WITH(walk+1, "ip")) {
+                        outwalk += print_ip_addr(outwalk, addrs, false);
                         walk += strlen("ip");
                 } else if (strncmp(walk+1, "speed", strlen("speed")) == 0) {
-                        outwalk += print_eth_speed(outwalk, interface);
+#if defined(LINUX)
+                        if (link == NULL)
+                                link = get_eth_link(interface);
+#endif
+                        outwalk += print_eth_speed(outwalk, interface, link);
                         walk += strlen("speed");
+                } else if (strncmp(walk+1, "duplex", strlen("duplex")) == 0) {
+#if defined(LINUX)
+                        if (link == NULL)
+                                link = get_eth_link(interface);
+                        outwalk += sprintf(outwalk, "%s", link->duplex);
+#else
+                        outwalk += sprintf(outwalk, "?");
+#endif
+                        walk += strlen("duplex");
                 }
         }
 
@@ -2,66 +2,165 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <netdb.h>
 #include <ifaddrs.h>
 #include <net/if.h>
 
 #include "i3status.h"
 
 /*
- * Return the IP address for the given interface or "no IP" if the
- * interface is up and running but hasn't got an IP address yet
+ * The addresses of all interfaces, as returned by getifaddrs(). They are read
+ * again only when ifstate reports a change (an interface went up or down or
+ * an address was added or removed).
  *
  */
-const char *get_ip_addr(const char *interface) {
-        static char part[512];
-        socklen_t len = sizeof(struct sockaddr_in);
-        memset(part, 0, sizeof(part));
+static struct if_addrs *interfaces;
+static int num_interfaces = 0;
+static unsigned long interfaces_generation = 0;
 
-        struct ifaddrs *ifaddr, *addrp;
-        bool found = false;
+static int netmask_prefix(const struct sockaddr *netmask) {
+        const unsigned char *bytes;
+        int len, prefix = 0;
 
-        getifaddrs(&ifaddr);
+        if (netmask == NULL)
+                return -1;
+        if (netmask->sa_family == AF_INET) {
+                bytes = (const unsigned char *)&((const struct sockaddr_in *)netmask)->sin_addr;
+                len = 4;
+        } else {
+                bytes = (const unsigned char *)&((const struct sockaddr_in6 *)netmask)->sin6_addr;
+                len = 16;
+        }
+        for (int i = 0; i < len; i++)
+                for (unsigned char bit = 0x80; bit != 0 && (bytes[i] & bit); bit >>= 1)
+                        prefix++;
+        return prefix;
+}
 
-        if (ifaddr == NULL)
-                return NULL;
+static struct if_addrs *find_interface(const char *name) {
+        for (int i = 0; i < num_interfaces; i++)
+                if (strcmp(interfaces[i].name, name) == 0)
+                        return &interfaces[i];
+        return NULL;
+}
 
-        /* Skip until we are at the AF_INET address of interface */
-        for (addrp = ifaddr;
+static void read_interfaces(void) {
+        struct ifaddrs *ifaddr, *addrp;
+
+        num_interfaces = 0;
+        if (getifaddrs(&ifaddr) == -1)
+                return;
 
-             (addrp != NULL &&
-              (strcmp(addrp->ifa_name, interface) != 0 ||
-               addrp->ifa_addr == NULL ||
-               addrp->ifa_addr->sa_family != AF_INET));
+        for (addrp = ifaddr; addrp != NULL; addrp = addrp->ifa_next) {
+                struct if_addrs *ifa = find_interface(addrp->ifa_name);
+                if (ifa == NULL) {
+                        struct if_addrs *grown = realloc(interfaces, sizeof(struct if_addrs) * (num_interfaces + 1));
+                        if (grown == NULL)
+                                break;
+                        interfaces = grown;
+                        ifa = &interfaces[num_interfaces++];
+                        memset(ifa, 0, sizeof(struct if_addrs));
+                        (void)snprintf(ifa->name, sizeof(ifa->name), "%s", addrp->ifa_name);
+                }
+                ifa->flags = addrp->ifa_flags;
 
-             addrp = addrp->ifa_next) {
-                /* Check if the interface is down */
-                if (strcmp(addrp->ifa_name, interface) != 0)
+                if (addrp->ifa_addr == NULL ||
+                    (addrp->ifa_addr->sa_family != AF_INET && addrp->ifa_addr->sa_family != AF_INET6) ||
+                    ifa->num_addrs == MAX_IF_ADDRS)
                         continue;
-                found = true;
-                if ((addrp->ifa_flags & IFF_RUNNING) == 0) {
-                        freeifaddrs(ifaddr);
-                        return NULL;
+
+                struct ip_addr *addr = &ifa->addrs[ifa->num_addrs++];
+                addr->family = addrp->ifa_addr->sa_family;
+                addr->prefix = netmask_prefix(addrp->ifa_netmask);
+                if (addr->family == AF_INET) {
+                        addr->addr.v4 = ((struct sockaddr_in *)addrp->ifa_addr)->sin_addr;
+                        addr->link_local = false;
+                } else {
+                        addr->addr.v6 = ((struct sockaddr_in6 *)addrp->ifa_addr)->sin6_addr;
+                        addr->link_local = IN6_IS_ADDR_LINKLOCAL(&addr->addr.v6);
                 }
         }
 
-        if (addrp == NULL) {
-                freeifaddrs(ifaddr);
-                return (found ? "no IP" : NULL);
-        }
+        freeifaddrs(ifaddr);
+}
 
-        int ret;
-        if ((ret = getnameinfo(addrp->ifa_addr, len, part, sizeof(part), NULL, 0, NI_NUMERICHOST)) != 0) {
-                fprintf(stderr, "i3status: getnameinfo(): %s\n", gai_strerror(ret));
-                freeifaddrs(ifaddr);
-                return "no IP";
+/*
+ * Returns the addresses of the given interface, or NULL if the interface does
+ * not exist or is down.
+ *
+ */
+const struct if_addrs *get_if_addrs(const char *interface) {
+        unsigned long generation = ifstate_generation();
+        const struct if_addrs *ifa;
+
+        if (generation != interfaces_generation) {
+                read_interfaces();
+                interfaces_generation = generation;
         }
 
-        freeifaddrs(ifaddr);
-        return part;
+        if ((ifa = find_interface(interface)) == NULL || (ifa->flags & IFF_RUNNING) == 0)
+                return NULL;
+        return ifa;
 }
 
+static int format_addr(char *outwalk, const struct ip_addr *addr, bool cidr) {
+        /* inet_ntop writes straight into the output buffer. */
+        if (inet_ntop(addr->family, &addr->addr, outwalk, INET6_ADDRSTRLEN) == NULL)
+                return sprintf(outwalk, "?");
+        int len = strlen(outwalk);
+        if (cidr && addr->prefix >= 0)
+                len += sprintf(outwalk + len, "/%d", addr->prefix);
+        return len;
+}
+
+/*
+ * Prints the primary address of the interface: the first IPv4 address or, on
+ * IPv6-only interfaces, the first IPv6 address which is not link-local.
+ * Prints "no IP" if there is none.
+ *
+ */
+int print_ip_addr(char *outwalk, const struct if_addrs *ifa, bool cidr) {
+        const struct ip_addr *ipv6 = NULL;
+
+        for (int i = 0; i < ifa->num_addrs; i++) {
+                if (ifa->addrs[i].family == AF_INET)
+                        return format_addr(outwalk, &ifa->addrs[i], cidr);
+                if (ipv6 == NULL && !ifa->addrs[i].link_local)
+                        ipv6 = &ifa->addrs[i];
+        }
+        if (ipv6 != NULL)
+                return format_addr(outwalk, ipv6, cidr);
+        return sprintf(outwalk, "no IP");
+}
+
+/*
+ * Prints all addresses of the given family, separated by spaces. Link-local
+ * IPv6 addresses are only printed if there is no other IPv6 address.
+ *
+ */
+int print_ip_addrs(char *outwalk, const struct if_addrs *ifa, int family) {
+        char *start = outwalk;
+        bool link_local = true;
+
+        if (family == AF_INET6) {
+                for (int i = 0; i < ifa->num_addrs && link_local; i++)
+                        if (ifa->addrs[i].family == AF_INET6 && !ifa->addrs[i].link_local)
+                                link_local = false;
+        }
+
+        for (int i = 0; i < ifa->num_addrs; i++) {
+                if (ifa->addrs[i].family != family || (ifa->addrs[i].link_local && !link_local))
+                        continue;
+                if (outwalk != start)
+                        *(outwalk++) = ' ';
+                outwalk += format_addr(outwalk, &ifa->addrs[i], false);
+        }
+
+        if (outwalk == start)
+                return sprintf(outwalk, (family == AF_INET ? "no IPv4" : "no IPv6"));
+        return outwalk - start;
+}
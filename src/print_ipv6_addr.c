@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <netdb.h>
 #include <string.h>
+#include <errno.h>
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_version.h>
 
@@ -22,7 +23,7 @@ static char *get_sockname(struct addrinfo *addr) {
         int fd;
 
         if ((fd = socket(addr->ai_family, SOCK_DGRAM, 0)) == -1) {
-                perror("socket()");
+                stats_error("socket(): %s", strerror(errno));
                 return NULL;
         }
 
@@ -42,7 +43,7 @@ static char *get_sockname(struct addrinfo *addr) {
 
         socklen_t local_len = sizeof(struct sockaddr_storage);
         if (getsockname(fd, (struct sockaddr*)&local, &local_len) == -1) {
-                perror("getsockname()");
+                stats_error("getsockname(): %s", strerror(errno));
                 (void)close(fd);
                 return NULL;
         }
@@ -51,7 +52,7 @@ static char *get_sockname(struct addrinfo *addr) {
         if ((ret = getnameinfo((struct sockaddr*)&local, local_len,
                                buf, sizeof(buf), NULL, 0,
                                NI_NUMERICHOST)) != 0) {
-                fprintf(stderr, "i3status: getnameinfo(): %s\n", gai_strerror(ret));
+                stats_error("getnameinfo(): %s", gai_strerror(ret));
                 (void)close(fd);
                 return NULL;
         }
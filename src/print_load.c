@@ -6,27 +6,105 @@
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_version.h>
 
-void print_load(yajl_gen json_gen, char *buffer, const char *format, const float max_threshold) {
+#if defined(LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+
+static int loadavg_fd = -1;
+
+/*
+ * Reads /proc/loadavg (kept open), which looks like
+ * "0.52 0.58 0.59 2/345 12345": the three load averages, the number of
+ * runnable and total tasks and the last PID.
+ *
+ */
+static bool read_loadavg(double loadavg[3], long *running, long *total) {
+        char buf[128], *walk = buf;
+        ssize_t n;
+
+        if (loadavg_fd == -1 && (loadavg_fd = open_rooted("/proc/loadavg", O_RDONLY | O_CLOEXEC)) == -1)
+                return false;
+        if ((n = pread(loadavg_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+                return false;
+        buf[n] = '\0';
+
+        for (int i = 0; i < 3; i++)
+                loadavg[i] = strtod(walk, &walk);
+        *running = strtol(walk, &walk, 10);
+        if (*walk != '/')
+                return false;
+        *total = strtol(walk + 1, NULL, 10);
+        return true;
+}
+#endif
+
+/* The number of online CPUs, or 0 if it needs to be determined again. */
+static long online_cpus = 0;
+
+#if defined(LINUX)
+static void cpu_hotplug(const struct uevent *event, void *data) {
+        if (strcmp(event->action, "online") == 0 || strcmp(event->action, "offline") == 0 ||
+            strcmp(event->action, "add") == 0 || strcmp(event->action, "remove") == 0)
+                online_cpus = 0;
+}
+#endif
+
+/*
+ * Returns the number of online CPUs. The value is cached and, where uevents
+ * are available, invalidated when a CPU is brought online or offline.
+ * Without uevents, it is determined again every time.
+ *
+ */
+static long get_online_cpus(void) {
+        static bool subscribed = false;
+        static bool hotplug_events = false;
+
+        if (!subscribed) {
+                subscribed = true;
+#if defined(LINUX)
+                hotplug_events = uevent_subscribe("cpu", cpu_hotplug, NULL);
+#endif
+        }
+
+        if (online_cpus == 0 || !hotplug_events) {
+                online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                if (online_cpus < 1)
+                        online_cpus = 1;
+        }
+        return online_cpus;
+}
+
+void print_load(yajl_gen json_gen, char *buffer, const char *format, const float max_threshold, bool threshold_per_cpu) {
         char *outwalk = buffer;
         /* Get load */
 
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__) || defined(linux) || defined(__OpenBSD__) || defined(__NetBSD__) || defined(__APPLE__) || defined(sun) || defined(__DragonFly__)
         double loadavg[3];
+        long running = -1, total = -1;
         const char *walk;
         bool colorful_output = false;
+        double threshold = max_threshold;
+        bool have_loadavg = false;
 
-        if (getloadavg(loadavg, 3) == -1)
+#if defined(LINUX)
+        have_loadavg = read_loadavg(loadavg, &running, &total);
+#endif
+        if (!have_loadavg && getloadavg(loadavg, 3) == -1)
                 goto error;
 
+        if (threshold_per_cpu)
+                threshold *= get_online_cpus();
+
+        if (loadavg[0] >= threshold) {
+                START_COLOR("color_bad");
+                colorful_output = true;
+        }
+
         for (walk = format; *walk != '\0'; walk++) {
                 if (*walk != '%') {
                         *(outwalk++) = *walk;
                         continue;
                 }
-                if (loadavg[0] >= max_threshold) {
-                        START_COLOR("color_bad");
-                        colorful_output = true;
-                }
 
                 if (BEGINS_WITH(walk+1, "1min")) {
                         outwalk += sprintf(outwalk, "%1.2f", loadavg[0]);
@@ -42,10 +120,22 @@ void print_load(yajl_gen json_gen, char *buffer, const char *format, const float
                         outwalk += sprintf(outwalk, "%1.2f", loadavg[2]);
                         walk += strlen("15min");
                 }
-                if (colorful_output)
-                        END_COLOR;
+
+                /* The task counts are only available on Linux. */
+                if (BEGINS_WITH(walk+1, "running")) {
+                        outwalk += (running >= 0 ? sprintf(outwalk, "%ld", running) : sprintf(outwalk, "?"));
+                        walk += strlen("running");
+                }
+
+                if (BEGINS_WITH(walk+1, "total")) {
+                        outwalk += (total >= 0 ? sprintf(outwalk, "%ld", total) : sprintf(outwalk, "?"));
+                        walk += strlen("total");
+                }
         }
 
+        if (colorful_output)
+                END_COLOR;
+
         *outwalk = '\0';
         OUTPUT_FULL_TEXT(buffer);
 
@@ -53,5 +143,5 @@ void print_load(yajl_gen json_gen, char *buffer, const char *format, const float
 error:
 #endif
         OUTPUT_FULL_TEXT("cant read load");
-        (void)fputs("i3status: Cannot read system load using getloadavg()\n", stderr);
+        stats_error("Cannot read system load using getloadavg()");
 }
@@ -0,0 +1,205 @@
+// vim:ts=8:expandtab
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+
+#if defined(LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * The keys of /proc/meminfo we are interested in. Their values are given in
+ * kB and returned in bytes by read_meminfo(), indexed by this enum.
+ *
+ */
+enum meminfo_key {
+        MEM_TOTAL,
+        MEM_FREE,
+        MEM_AVAILABLE,
+        MEM_BUFFERS,
+        MEM_CACHED,
+        MEM_SHMEM,
+        MEM_SWAP_TOTAL,
+        MEM_SWAP_FREE,
+        MEMINFO_KEYS
+};
+
+#define MEMINFO_KEY(key) {key ":", sizeof(key ":") - 1}
+static const struct {
+        const char *name;
+        size_t len;
+} meminfo_keys[MEMINFO_KEYS] = {
+        [MEM_TOTAL] = MEMINFO_KEY("MemTotal"),
+        [MEM_FREE] = MEMINFO_KEY("MemFree"),
+        [MEM_AVAILABLE] = MEMINFO_KEY("MemAvailable"),
+        [MEM_BUFFERS] = MEMINFO_KEY("Buffers"),
+        [MEM_CACHED] = MEMINFO_KEY("Cached"),
+        [MEM_SHMEM] = MEMINFO_KEY("Shmem"),
+        [MEM_SWAP_TOTAL] = MEMINFO_KEY("SwapTotal"),
+        [MEM_SWAP_FREE] = MEMINFO_KEY("SwapFree"),
+};
+
+static int meminfo_fd = -1;
+/* /proc/meminfo is about 1.5 KiB on current kernels. */
+static char meminfo_buf[4096];
+
+/*
+ * Reads /proc/meminfo (kept open) and parses the keys listed above in a single
+ * pass over the buffer. Returns a bitmask of the keys which were found.
+ *
+ */
+static unsigned int read_meminfo(uint64_t values[MEMINFO_KEYS]) {
+        unsigned int found = 0;
+        ssize_t n;
+
+        if (meminfo_fd == -1 && (meminfo_fd = open_rooted("/proc/meminfo", O_RDONLY | O_CLOEXEC)) == -1)
+                return 0;
+        if ((n = pread(meminfo_fd, meminfo_buf, sizeof(meminfo_buf) - 1, 0)) <= 0)
+                return 0;
+        meminfo_buf[n] = '\0';
+
+        for (char *line = meminfo_buf; line != NULL && found != (1u << MEMINFO_KEYS) - 1;) {
+                for (int key = 0; key < MEMINFO_KEYS; key++) {
+                        if (strncmp(line, meminfo_keys[key].name, meminfo_keys[key].len) != 0)
+                                continue;
+                        uint64_t value = 0;
+                        for (line += meminfo_keys[key].len; *line == ' '; line++)
+                                ;
+                        for (; *line >= '0' && *line <= '9'; line++)
+                                value = value * 10 + (*line - '0');
+                        values[key] = value * 1024;
+                        found |= (1u << key);
+                        break;
+                }
+                if ((line = strchr(line, '\n')) != NULL)
+                        line++;
+        }
+        return found;
+}
+
+/*
+ * Parses a threshold like "10%" (of the total memory) or "512M" into bytes.
+ * Returns 0 (i.e. the threshold is never reached) for NULL or empty strings.
+ *
+ */
+static uint64_t parse_threshold(const char *threshold, uint64_t total) {
+        char *end;
+        double value;
+
+        if (threshold == NULL || (value = strtod(threshold, &end)) <= 0)
+                return 0;
+
+        switch (*end) {
+                case '%':
+                        return total * value / 100;
+                case 'T':
+                case 't':
+                        value *= 1024;
+                /* fall-through */
+                case 'G':
+                case 'g':
+                        value *= 1024;
+                /* fall-through */
+                case 'M':
+                case 'm':
+                        value *= 1024;
+                /* fall-through */
+                case 'K':
+                case 'k':
+                        value *= 1024;
+                /* fall-through */
+                default:
+                        return value;
+        }
+}
+#endif
+
+/*
+ * Shows memory and swap usage from /proc/meminfo. The block is colored
+ * degraded/bad when the available memory falls below the respective threshold.
+ *
+ */
+void print_memory(yajl_gen json_gen, char *buffer, const char *format, const char *prefix_type, const char *threshold_degraded, const char *threshold_critical) {
+        char *outwalk = buffer;
+#if defined(LINUX)
+        uint64_t values[MEMINFO_KEYS] = {0};
+        uint64_t available, used, swap_used;
+        unsigned int found;
+        const char *walk;
+        bool colorful_output = false;
+
+        found = read_meminfo(values);
+        if ((found & (1u << MEM_TOTAL)) == 0 || values[MEM_TOTAL] == 0)
+                goto error;
+
+        /* MemAvailable was added in Linux 3.14. Before, approximate it the
+         * way free(1) did: shared memory is counted as cached but cannot be
+         * dropped. */
+        if (found & (1u << MEM_AVAILABLE))
+                available = values[MEM_AVAILABLE];
+        else {
+                available = values[MEM_FREE] + values[MEM_BUFFERS] + values[MEM_CACHED];
+                available -= (values[MEM_SHMEM] < available ? values[MEM_SHMEM] : available);
+        }
+        if (available > values[MEM_TOTAL])
+                available = values[MEM_TOTAL];
+        used = values[MEM_TOTAL] - available;
+        swap_used = (values[MEM_SWAP_TOTAL] > values[MEM_SWAP_FREE] ? values[MEM_SWAP_TOTAL] - values[MEM_SWAP_FREE] : 0);
+
+        if (available < parse_threshold(threshold_critical, values[MEM_TOTAL])) {
+                START_COLOR("color_bad");
+                colorful_output = true;
+        } else if (available < parse_threshold(threshold_degraded, values[MEM_TOTAL])) {
+                START_COLOR("color_degraded");
+                colorful_output = true;
+        }
+
+        for (walk = format; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+
+                if (BEGINS_WITH(walk+1, "total")) {
+                        outwalk += print_bytes_human(outwalk, values[MEM_TOTAL], prefix_type);
+                        walk += strlen("total");
+                } else if (BEGINS_WITH(walk+1, "used")) {
+                        outwalk += print_bytes_human(outwalk, used, prefix_type);
+                        walk += strlen("used");
+                } else if (BEGINS_WITH(walk+1, "available")) {
+                        outwalk += print_bytes_human(outwalk, available, prefix_type);
+                        walk += strlen("available");
+                } else if (BEGINS_WITH(walk+1, "percentage_used")) {
+                        outwalk += sprintf(outwalk, "%.1f%%", 100.0 * used / values[MEM_TOTAL]);
+                        walk += strlen("percentage_used");
+                } else if (BEGINS_WITH(walk+1, "percentage_available")) {
+                        outwalk += sprintf(outwalk, "%.1f%%", 100.0 * available / values[MEM_TOTAL]);
+                        walk += strlen("percentage_available");
+                } else if (BEGINS_WITH(walk+1, "swap_total")) {
+                        outwalk += print_bytes_human(outwalk, values[MEM_SWAP_TOTAL], prefix_type);
+                        walk += strlen("swap_total");
+                } else if (BEGINS_WITH(walk+1, "swap_used")) {
+                        outwalk += print_bytes_human(outwalk, swap_used, prefix_type);
+                        walk += strlen("swap_used");
+                } else if (BEGINS_WITH(walk+1, "swap_free")) {
+                        outwalk += print_bytes_human(outwalk, values[MEM_SWAP_FREE], prefix_type);
+                        walk += strlen("swap_free");
+                }
+        }
+
+        if (colorful_output)
+                END_COLOR;
+
+        *outwalk = '\0';
+        OUTPUT_FULL_TEXT(buffer);
+        return;
+error:
+#endif
+        OUTPUT_FULL_TEXT("cant read memory");
+        stats_error("Cannot read memory usage from /proc/meminfo");
+}
@@ -5,7 +5,6 @@
 #include <assert.h>
 
 #include <mpd/client.h>
-#include <libnotify/notify.h>
 
 #include "i3status.h"
 
@@ -71,9 +70,7 @@ void mpd_send_notification(
         outwalk = body;
         mpd_format_string(song, body_format, body, &outwalk);
 
-        NotifyNotification *song_notif = notify_notification_new(header, body, "dialog-information");
-        notify_notification_show(song_notif, NULL);
-        g_object_unref(G_OBJECT(song_notif));
+        send_notification("mpd", header, body, false);
 }
 
 void print_mpd(
@@ -0,0 +1,324 @@
+// vim:ts=8:expandtab
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+
+#if defined(LINUX)
+#include <limits.h>
+
+#include "queue.h"
+
+enum supply_type { SUPPLY_UNKNOWN, SUPPLY_MAINS, SUPPLY_USB, SUPPLY_BATTERY, SUPPLY_UPS };
+
+/*
+ * An entry of /sys/class/power_supply. The properties are read from the
+ * supply's uevent file when it is found and afterwards updated from the
+ * "change" uevents the kernel sends, which carry the same properties. Since
+ * many drivers do not send such an event for every percent of capacity, the
+ * uevent files of batteries and UPSs are read again on every update.
+ *
+ */
+struct power_supply {
+        char *name;
+        enum supply_type type;
+        /* Whether the supply powers a peripheral (POWER_SUPPLY_SCOPE=Device),
+         * like a wireless mouse, instead of the system. */
+        bool device_scope;
+        bool online;
+        /* Only for batteries and UPSs: the status and the capacity in percent,
+         * or -1 if unknown. */
+        charging_status_t status;
+        int capacity;
+
+        TAILQ_ENTRY(power_supply) supplies;
+};
+
+static TAILQ_HEAD(supplies_head, power_supply) supplies = TAILQ_HEAD_INITIALIZER(supplies);
+
+/* Whether uevents keep the supplies up to date. Otherwise, they are read again
+ * every time and the class directory is checked for added or removed
+ * supplies. */
+static bool watching = false;
+/* Set when a supply was added or removed, so that the class directory is
+ * enumerated again. */
+static bool enumerate = true;
+
+static enum supply_type parse_type(const char *type) {
+        if (strcmp(type, "Mains") == 0)
+                return SUPPLY_MAINS;
+        if (BEGINS_WITH(type, "USB"))
+                return SUPPLY_USB;
+        if (strcmp(type, "Battery") == 0)
+                return SUPPLY_BATTERY;
+        if (strcmp(type, "UPS") == 0)
+                return SUPPLY_UPS;
+        return SUPPLY_UNKNOWN;
+}
+
+/*
+ * Updates the supply from NUL-separated POWER_SUPPLY_* properties.
+ *
+ */
+static void parse_properties(struct power_supply *supply, const char *buf, size_t len) {
+        for (const char *walk = buf; walk < buf + len; walk += strlen(walk) + 1) {
+                if (!BEGINS_WITH(walk, "POWER_SUPPLY_"))
+                        continue;
+                const char *key = walk + strlen("POWER_SUPPLY_");
+
+                if (BEGINS_WITH(key, "TYPE="))
+                        supply->type = parse_type(key + strlen("TYPE="));
+                else if (BEGINS_WITH(key, "SCOPE="))
+                        supply->device_scope = (strcmp(key + strlen("SCOPE="), "Device") == 0);
+                else if (BEGINS_WITH(key, "ONLINE="))
+                        supply->online = (atoi(key + strlen("ONLINE=")) != 0);
+                else if (BEGINS_WITH(key, "CAPACITY="))
+                        supply->capacity = atoi(key + strlen("CAPACITY="));
+                else if (BEGINS_WITH(key, "STATUS=")) {
+                        key += strlen("STATUS=");
+                        if (strcmp(key, "Charging") == 0)
+                                supply->status = CS_CHARGING;
+                        else if (strcmp(key, "Full") == 0)
+                                supply->status = CS_FULL;
+                        else
+                                supply->status = CS_DISCHARGING;
+                }
+        }
+}
+
+static bool read_supply(struct power_supply *supply) {
+        char path[PATH_MAX];
+        char buf[4096];
+        size_t len;
+
+        (void)snprintf(path, sizeof(path), "/sys/class/power_supply/%s/uevent", supply->name);
+        if (!slurp(path, buf, sizeof(buf)))
+                return false;
+        /* The file has one property per line, the uevent one per string. */
+        len = strlen(buf);
+        for (size_t i = 0; i < len; i++)
+                if (buf[i] == '\n')
+                        buf[i] = '\0';
+        parse_properties(supply, buf, len);
+        return true;
+}
+
+static void free_supplies(void) {
+        struct power_supply *supply;
+
+        while (!TAILQ_EMPTY(&supplies)) {
+                supply = TAILQ_FIRST(&supplies);
+                TAILQ_REMOVE(&supplies, supply, supplies);
+                free(supply->name);
+                free(supply);
+        }
+}
+
+static void enumerate_supplies(void) {
+        glob_t globbuf;
+
+        free_supplies();
+        if (glob_rooted("/sys/class/power_supply/*/uevent", GLOB_NOSORT, &globbuf) != 0)
+                return;
+
+        for (size_t i = 0; i < globbuf.gl_pathc; i++) {
+                struct power_supply *supply;
+                char *name = globbuf.gl_pathv[i] + strlen(globbuf.gl_pathv[i]) - strlen("/uevent");
+
+                *name = '\0';
+                name = strrchr(globbuf.gl_pathv[i], '/') + 1;
+                if ((supply = calloc(1, sizeof(struct power_supply))) == NULL ||
+                    (supply->name = strdup(name)) == NULL)
+                        die("Error: out of memory\n");
+                supply->capacity = -1;
+                if (!read_supply(supply)) {
+                        free(supply->name);
+                        free(supply);
+                        continue;
+                }
+                TAILQ_INSERT_TAIL(&supplies, supply, supplies);
+        }
+        globfree(&globbuf);
+}
+
+/*
+ * Returns whether the supplies in the class directory differ from the known
+ * ones.
+ *
+ */
+static bool supplies_changed(void) {
+        struct power_supply *supply;
+        glob_t globbuf;
+        size_t known = 0;
+        bool changed = false;
+
+        if (glob_rooted("/sys/class/power_supply/*/uevent", GLOB_NOSORT, &globbuf) != 0)
+                return !TAILQ_EMPTY(&supplies);
+
+        TAILQ_FOREACH(supply, &supplies, supplies)
+                known++;
+        if (known != globbuf.gl_pathc)
+                changed = true;
+        for (size_t i = 0; i < globbuf.gl_pathc && !changed; i++) {
+                char *end = globbuf.gl_pathv[i] + strlen(globbuf.gl_pathv[i]) - strlen("/uevent");
+                *end = '\0';
+                const char *name = strrchr(globbuf.gl_pathv[i], '/') + 1;
+
+                changed = true;
+                TAILQ_FOREACH(supply, &supplies, supplies) {
+                        if (strcmp(supply->name, name) == 0) {
+                                changed = false;
+                                break;
+                        }
+                }
+        }
+        globfree(&globbuf);
+        return changed;
+}
+
+static void supply_changed(const struct uevent *event, void *data) {
+        const char *name = strrchr(event->devpath, '/');
+        struct power_supply *supply;
+
+        if (strcmp(event->action, "change") != 0) {
+                enumerate = true;
+        } else if (name != NULL) {
+                TAILQ_FOREACH(supply, &supplies, supplies) {
+                        if (strcmp(supply->name, name + 1) == 0) {
+                                parse_properties(supply, event->buf, event->len);
+                                break;
+                        }
+                }
+        }
+        events_request_refresh(&supplies);
+}
+
+static void update_supplies(void) {
+        static bool subscribed = false;
+        struct power_supply *supply;
+        const char *sys = "/sys";
+        char buf[PATH_MAX];
+
+        if (!subscribed) {
+                subscribed = true;
+                /* With fs_root, the kernel’s events are about other files. */
+                if (root_path(sys, buf, sizeof(buf)) == sys)
+                        watching = uevent_subscribe("power_supply", supply_changed, NULL);
+        }
+
+        if (!watching && !enumerate)
+                enumerate = supplies_changed();
+        if (enumerate) {
+                enumerate_supplies();
+                enumerate = false;
+                return;
+        }
+
+        /* Without uevents, the online state of the AC adapter has to be read
+         * again as well. */
+        TAILQ_FOREACH(supply, &supplies, supplies)
+                if (!watching || supply->type == SUPPLY_BATTERY || supply->type == SUPPLY_UPS)
+                        (void)read_supply(supply);
+}
+#endif
+
+/*
+ * Shows where the power comes from: "AC" if a mains or USB supply is online,
+ * otherwise "BAT" (or "UPS" if the only online supply is a UPS), together with
+ * the combined state of the batteries. Supplies are enumerated once and kept
+ * up to date through uevents, so plugging in the charger updates the bar right
+ * away. Batteries are read on every update.
+ *
+ */
+void print_power(yajl_gen json_gen, char *buffer, const char *format, const char *format_down) {
+        char *outwalk = buffer;
+        const char *walk;
+
+#if defined(LINUX)
+        struct power_supply *supply;
+        int system_supplies = 0, mains = 0, usb = 0, ups = 0, batteries = 0;
+        int capacity = 0, capacities = 0;
+        bool charging = false, full = true;
+
+        update_supplies();
+        events_depend(&supplies);
+
+        TAILQ_FOREACH(supply, &supplies, supplies) {
+                if (supply->device_scope)
+                        continue;
+                system_supplies++;
+                switch (supply->type) {
+                        case SUPPLY_MAINS:
+                                mains += supply->online;
+                                break;
+                        case SUPPLY_USB:
+                                usb += supply->online;
+                                break;
+                        case SUPPLY_UPS:
+                                ups += supply->online;
+                                break;
+                        case SUPPLY_BATTERY:
+                                batteries++;
+                                charging |= (supply->status == CS_CHARGING);
+                                full &= (supply->status == CS_FULL);
+                                if (supply->capacity >= 0) {
+                                        capacity += supply->capacity;
+                                        capacities++;
+                                }
+                                break;
+                        default:
+                                break;
+                }
+        }
+
+        if (system_supplies == 0) {
+                OUTPUT_FULL_TEXT(format_down);
+                return;
+        }
+
+        bool on_ac = (mains > 0 || usb > 0);
+        if (!on_ac)
+                START_COLOR("color_degraded");
+
+        for (walk = format; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+
+                if (BEGINS_WITH(walk+1, "source")) {
+                        outwalk += sprintf(outwalk, "%s", (on_ac ? "AC" : (ups > 0 ? "UPS" : "BAT")));
+                        walk += strlen("source");
+                } else if (BEGINS_WITH(walk+1, "status")) {
+                        if (batteries == 0)
+                                outwalk += sprintf(outwalk, "-");
+                        else
+                                outwalk += sprintf(outwalk, "%s", (charging ? "CHR" : (full ? "FULL" : "BAT")));
+                        walk += strlen("status");
+                } else if (BEGINS_WITH(walk+1, "capacity")) {
+                        if (capacities == 0)
+                                outwalk += sprintf(outwalk, "-");
+                        else
+                                outwalk += sprintf(outwalk, "%d%%", capacity / capacities);
+                        walk += strlen("capacity");
+                } else if (BEGINS_WITH(walk+1, "batteries")) {
+                        outwalk += sprintf(outwalk, "%d", batteries);
+                        walk += strlen("batteries");
+                } else if (BEGINS_WITH(walk+1, "usb")) {
+                        outwalk += sprintf(outwalk, "%d", usb);
+                        walk += strlen("usb");
+                }
+        }
+
+        if (!on_ac)
+                END_COLOR;
+#else
+        (void)walk;
+        (void)format;
+        outwalk += sprintf(outwalk, "%s", format_down);
+#endif
+        OUTPUT_FULL_TEXT(buffer);
+}
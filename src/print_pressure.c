@@ -0,0 +1,205 @@
+// vim:ts=8:expandtab
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+
+#if defined(LINUX)
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "queue.h"
+
+/*
+ * A /proc/pressure file. The file descriptor is kept open and, if a trigger is
+ * configured and supported by the kernel, carries the PSI trigger: the kernel
+ * then signals POLLPRI whenever the stall time within the trigger’s window
+ * exceeds its threshold. Since a file descriptor carries at most one trigger,
+ * blocks on the same resource with different triggers use separate sources.
+ *
+ */
+struct pressure_source {
+        char *resource;
+        char *trigger;
+        int fd;
+        bool triggered;
+
+        TAILQ_ENTRY(pressure_source) sources;
+};
+
+static TAILQ_HEAD(sources_head, pressure_source) sources = TAILQ_HEAD_INITIALIZER(sources);
+
+struct pressure {
+        double avg10, avg60, avg300;
+        unsigned long long total;
+};
+
+static void pressure_event(int fd, short revents, void *data) {
+        struct pressure_source *source = data;
+
+        if (revents & (POLLERR | POLLNVAL)) {
+                /* The trigger was destroyed, e.g. because the cgroup went
+                 * away. Keep reading the file at the normal interval. */
+                events_remove(fd);
+                source->triggered = false;
+                return;
+        }
+        events_request_refresh(source);
+}
+
+/*
+ * Writes the trigger (e.g. "some 150000 2000000": 150 ms of stall within 2 s)
+ * to the file. Triggers need Linux 5.2; unprivileged users need Linux 6.5 and
+ * a window which is a multiple of 2 s. Failure is not an error, the block is
+ * then only updated at its interval.
+ *
+ */
+static bool register_trigger(struct pressure_source *source, const char *path, const char *trigger) {
+        char buf[PATH_MAX];
+
+        /* With fs_root, the file is a regular file which the trigger would
+         * overwrite. */
+        if (trigger == NULL || *trigger == '\0' || root_path(path, buf, sizeof(buf)) != path)
+                return false;
+        if (write(source->fd, trigger, strlen(trigger) + 1) == -1) {
+                fprintf(stderr, "i3status: Cannot register PSI trigger \"%s\" on %s: %s\n", trigger, path, strerror(errno));
+                return false;
+        }
+        events_add(source->fd, POLLPRI, pressure_event, source);
+        return true;
+}
+
+static struct pressure_source *get_source(const char *resource, const char *trigger) {
+        struct pressure_source *source;
+        char path[64];
+
+        if (trigger == NULL)
+                trigger = "";
+        TAILQ_FOREACH(source, &sources, sources) {
+                if (strcmp(source->resource, resource) == 0 && strcmp(source->trigger, trigger) == 0)
+                        return source;
+        }
+
+        (void)snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+        if ((source = calloc(1, sizeof(struct pressure_source))) == NULL ||
+            (source->resource = strdup(resource)) == NULL ||
+            (source->trigger = strdup(trigger)) == NULL)
+                die("Error: out of memory\n");
+
+        /* Triggers need write access, fall back to read-only. */
+        if ((source->fd = open_rooted(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) != -1)
+                source->triggered = register_trigger(source, path, trigger);
+        else source->fd = open_rooted(path, O_RDONLY | O_CLOEXEC);
+
+        TAILQ_INSERT_TAIL(&sources, source, sources);
+        return source;
+}
+
+/*
+ * Parses a line like "some avg10=1.53 avg60=0.87 avg300=0.20 total=123456".
+ *
+ */
+static void parse_pressure_line(const char *line, struct pressure *pressure) {
+        const char *value;
+
+        if ((value = strstr(line, "avg10=")) != NULL)
+                pressure->avg10 = strtod(value + strlen("avg10="), NULL);
+        if ((value = strstr(line, "avg60=")) != NULL)
+                pressure->avg60 = strtod(value + strlen("avg60="), NULL);
+        if ((value = strstr(line, "avg300=")) != NULL)
+                pressure->avg300 = strtod(value + strlen("avg300="), NULL);
+        if ((value = strstr(line, "total=")) != NULL)
+                pressure->total = strtoull(value + strlen("total="), NULL, 10);
+}
+#endif
+
+/*
+ * Shows the pressure stall information of the given resource (cpu, memory or
+ * io): the share of time in which some (or all, for the full_ placeholders)
+ * tasks were stalled waiting for it.
+ *
+ */
+void print_pressure(yajl_gen json_gen, char *buffer, const char *resource, const char *format, const char *trigger, double threshold_degraded, double threshold_critical) {
+        char *outwalk = buffer;
+
+        INSTANCE(resource);
+
+#if defined(LINUX)
+        struct pressure_source *source = get_source(resource, trigger);
+        events_depend(source);
+        struct pressure some = {0}, full = {0};
+        char buf[256], *full_line;
+        const char *walk;
+        bool colorful_output = false;
+        ssize_t n;
+
+        if (source->fd == -1 || (n = pread(source->fd, buf, sizeof(buf) - 1, 0)) <= 0)
+                goto error;
+        buf[n] = '\0';
+
+        /* The full line is missing for cpu before Linux 5.13. */
+        if ((full_line = strstr(buf, "\nfull ")) != NULL) {
+                *full_line = '\0';
+                parse_pressure_line(full_line + 1, &full);
+        }
+        parse_pressure_line(buf, &some);
+
+        if (threshold_critical > 0 && some.avg10 >= threshold_critical) {
+                START_COLOR("color_bad");
+                colorful_output = true;
+        } else if (threshold_degraded > 0 && some.avg10 >= threshold_degraded) {
+                START_COLOR("color_degraded");
+                colorful_output = true;
+        }
+
+        for (walk = format; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+
+                struct pressure *pressure = &some;
+                const char *name = walk + 1;
+                if (BEGINS_WITH(name, "full_")) {
+                        pressure = &full;
+                        name += strlen("full_");
+                }
+
+                if (BEGINS_WITH(name, "avg10")) {
+                        outwalk += sprintf(outwalk, "%.2f", pressure->avg10);
+                        walk = name + strlen("avg10") - 1;
+                } else if (BEGINS_WITH(name, "avg60")) {
+                        outwalk += sprintf(outwalk, "%.2f", pressure->avg60);
+                        walk = name + strlen("avg60") - 1;
+                } else if (BEGINS_WITH(name, "avg300")) {
+                        outwalk += sprintf(outwalk, "%.2f", pressure->avg300);
+                        walk = name + strlen("avg300") - 1;
+                } else if (BEGINS_WITH(name, "total")) {
+                        /* The kernel counts microseconds. */
+                        outwalk += sprintf(outwalk, "%llu", pressure->total / 1000);
+                        walk = name + strlen("total") - 1;
+                } else if (BEGINS_WITH(name, "resource")) {
+                        outwalk += sprintf(outwalk, "%s", resource);
+                        walk = name + strlen("resource") - 1;
+                } else {
+                        *(outwalk++) = '%';
+                }
+        }
+
+        if (colorful_output)
+                END_COLOR;
+
+        *outwalk = '\0';
+        OUTPUT_FULL_TEXT(buffer);
+        return;
+error:
+#endif
+        OUTPUT_FULL_TEXT("cant read pressure");
+        stats_error("Cannot read /proc/pressure/%s (needs Linux 4.20 with CONFIG_PSI)", resource);
+}
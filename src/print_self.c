@@ -0,0 +1,50 @@
+// vim:ts=8:expandtab
+#include <stdio.h>
+#include <string.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+
+/*
+ * Shows how i3status itself is doing: the duration of the last tick, the
+ * resident memory and the number of errors reported by modules. The block is
+ * colored bad while any block is stale.
+ *
+ */
+void print_self(yajl_gen json_gen, char *buffer, const char *format, const char *prefix_type) {
+        const char *walk;
+        char *outwalk = buffer;
+        const bool stale = (stats_stale_blocks() > 0);
+
+        if (stale)
+                START_COLOR("color_bad");
+
+        for (walk = format; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+
+                if (BEGINS_WITH(walk+1, "tick_ms")) {
+                        outwalk += sprintf(outwalk, "%.1f", stats_last_tick_ms());
+                        walk += strlen("tick_ms");
+                } else if (BEGINS_WITH(walk+1, "rss")) {
+                        outwalk += print_bytes_human(outwalk, stats_rss(), prefix_type);
+                        walk += strlen("rss");
+                } else if (BEGINS_WITH(walk+1, "errors")) {
+                        outwalk += sprintf(outwalk, "%lu", stats_total_errors());
+                        walk += strlen("errors");
+                } else if (BEGINS_WITH(walk+1, "overruns")) {
+                        outwalk += sprintf(outwalk, "%lu", stats_overruns());
+                        walk += strlen("overruns");
+                } else if (BEGINS_WITH(walk+1, "stale")) {
+                        outwalk += sprintf(outwalk, "%u", stats_stale_blocks());
+                        walk += strlen("stale");
+                }
+        }
+
+        if (stale)
+                END_COLOR;
+        OUTPUT_FULL_TEXT(buffer);
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_version.h>
 
@@ -33,6 +34,67 @@ void set_timezone(const char *tz) {
         }
 }
 
+/*
+ * Returns how often the output of the given strftime() format changes, so
+ * that time blocks are only rendered when necessary. Conversions we do not
+ * know are assumed to change every second.
+ *
+ */
+enum time_granularity time_format_granularity(const char *format) {
+        enum time_granularity granularity = GRANULARITY_DAY;
+
+        for (const char *walk = format; *walk != '\0'; walk++) {
+                if (*walk != '%')
+                        continue;
+                walk++;
+                /* Skip flags, the field width and the E/O modifiers. */
+                while (*walk != '\0' && strchr("_-0^#+123456789EO", *walk) != NULL)
+                        walk++;
+                if (*walk == '\0')
+                        break;
+
+                if (strchr("aAbBCdDeFgGhjmnuUVwWxyY%t", *walk) != NULL)
+                        continue;
+                if (strchr("HIklpPzZ", *walk) != NULL) {
+                        /* The time zone changes with daylight saving time,
+                         * which happens on full hours. */
+                        granularity = min(granularity, GRANULARITY_HOUR);
+                } else if (strchr("MR", *walk) != NULL) {
+                        granularity = min(granularity, GRANULARITY_MINUTE);
+                } else {
+                        return GRANULARITY_SECOND;
+                }
+        }
+        return granularity;
+}
+
+/*
+ * Returns the time of the next second, minute, hour or day boundary after t,
+ * in the given time zone (NULL for local time).
+ *
+ */
+time_t time_next_boundary(time_t t, enum time_granularity granularity, const char *tz) {
+        struct tm tm;
+
+        set_timezone(tz);
+        localtime_r(&t, &tm);
+        switch (granularity) {
+                case GRANULARITY_SECOND:
+                        return t + 1;
+                case GRANULARITY_MINUTE:
+                        return t - tm.tm_sec + 60;
+                case GRANULARITY_HOUR:
+                        return t - tm.tm_min * 60 - tm.tm_sec + 3600;
+                default:
+                        /* Midnight is not always 24 hours away, mktime()
+                         * takes care of daylight saving time. */
+                        tm.tm_mday++;
+                        tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+                        tm.tm_isdst = -1;
+                        return mktime(&tm);
+        }
+}
+
 void print_time(yajl_gen json_gen, char *buffer, const char *format, const char *tz, time_t t) {
         char *outwalk = buffer;
         struct tm tm;
@@ -0,0 +1,347 @@
+// vim:ts=8:expandtab
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+#include "queue.h"
+
+#if defined(LINUX)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/wireguard.h>
+
+/* A peer whose last handshake is older than this is considered stale (this is
+ * REJECT_AFTER_TIME of the WireGuard protocol). */
+#define WG_HANDSHAKE_TIMEOUT 180
+/* Upper bound for the backoff between WireGuard queries which failed. */
+#define WG_MAX_BACKOFF 300
+
+static int genl_fd = -1;
+static int wg_family = -1;
+static unsigned int genl_seq = 0;
+#endif
+
+/*
+ * The state of one tunnel block. For WireGuard interfaces, the peer
+ * statistics of the last successful query are kept.
+ *
+ */
+struct tunnel {
+        char *interface;
+        unsigned long generation;
+        bool is_wireguard;
+
+        /* Query backoff: no query is sent before next_query. */
+        time_t next_query;
+        int backoff;
+        bool wg_valid;
+
+        int peers;
+        int peers_up;
+        time_t last_handshake;
+        uint64_t rx_bytes;
+        uint64_t tx_bytes;
+
+        TAILQ_ENTRY(tunnel) tunnels;
+};
+
+static TAILQ_HEAD(tunnels_head, tunnel) tunnels = TAILQ_HEAD_INITIALIZER(tunnels);
+
+#if defined(LINUX)
+/*
+ * Appends an attribute to the netlink message.
+ *
+ */
+static void add_attr(struct nlmsghdr *nlh, unsigned short type, const void *data, size_t len) {
+        struct nlattr *attr = (struct nlattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+        attr->nla_type = type;
+        attr->nla_len = NLA_HDRLEN + len;
+        memcpy((char *)attr + NLA_HDRLEN, data, len);
+        nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(attr->nla_len);
+}
+
+#define for_each_attr(attr, start, len)                                                \
+        for (struct nlattr *attr = (struct nlattr *)(start);                           \
+             (char *)attr + NLA_HDRLEN <= (char *)(start) + (len) &&                   \
+             attr->nla_len >= NLA_HDRLEN &&                                           \
+             (char *)attr + attr->nla_len <= (char *)(start) + (len);                  \
+             attr = (struct nlattr *)((char *)attr + NLA_ALIGN(attr->nla_len)))
+
+#define ATTR_DATA(attr) ((char *)(attr) + NLA_HDRLEN)
+#define ATTR_LEN(attr) ((attr)->nla_len - NLA_HDRLEN)
+#define ATTR_TYPE(attr) ((attr)->nla_type & NLA_TYPE_MASK)
+
+/*
+ * Sends a generic netlink request and calls cb for every reply message until
+ * the end of the (dump) reply. Returns 0 or a negative errno.
+ *
+ */
+static int genl_request(struct nlmsghdr *nlh, void (*cb)(struct nlattr *attrs, int len, void *data), void *data) {
+        /* Dumps are split into messages of at most one page. */
+        static char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+        int n;
+
+        nlh->nlmsg_seq = ++genl_seq;
+        if (send(genl_fd, nlh, nlh->nlmsg_len, 0) == -1)
+                return -errno;
+
+        while ((n = recv(genl_fd, buf, sizeof(buf), 0)) > 0) {
+                for (struct nlmsghdr *reply = (struct nlmsghdr *)buf; NLMSG_OK(reply, n); reply = NLMSG_NEXT(reply, n)) {
+                        if (reply->nlmsg_seq != genl_seq)
+                                continue;
+                        if (reply->nlmsg_type == NLMSG_DONE)
+                                return 0;
+                        if (reply->nlmsg_type == NLMSG_ERROR) {
+                                int error = ((struct nlmsgerr *)NLMSG_DATA(reply))->error;
+                                if (error != 0 || !(nlh->nlmsg_flags & NLM_F_DUMP))
+                                        return error;
+                                continue;
+                        }
+                        cb((struct nlattr *)((char *)NLMSG_DATA(reply) + GENL_HDRLEN),
+                           reply->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), data);
+                        if (!(reply->nlmsg_flags & NLM_F_MULTI))
+                                return 0;
+                }
+        }
+        return (n == -1 ? -errno : -EIO);
+}
+
+struct genl_request {
+        struct nlmsghdr nlh;
+        struct genlmsghdr genl;
+        char attrs[64];
+};
+
+static void init_request(struct genl_request *req, uint16_t family, uint8_t cmd, uint16_t flags) {
+        memset(req, 0, sizeof(*req));
+        req->nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+        req->nlh.nlmsg_type = family;
+        req->nlh.nlmsg_flags = NLM_F_REQUEST | flags;
+        req->genl.cmd = cmd;
+        req->genl.version = 1;
+}
+
+static void family_reply(struct nlattr *attrs, int len, void *data) {
+        for_each_attr(attr, attrs, len)
+                if (ATTR_TYPE(attr) == CTRL_ATTR_FAMILY_ID)
+                        *(int *)data = *(uint16_t *)ATTR_DATA(attr);
+}
+
+/*
+ * Opens the generic netlink socket and looks up the id of the wireguard
+ * family. Returns 0 or a negative errno (-ENOENT if the module is not
+ * loaded).
+ *
+ */
+static int wg_init(void) {
+        struct genl_request req;
+        int ret;
+
+        if (genl_fd == -1 && (genl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC)) == -1)
+                return -errno;
+        if (wg_family != -1)
+                return 0;
+
+        init_request(&req, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 0);
+        add_attr(&req.nlh, CTRL_ATTR_FAMILY_NAME, WG_GENL_NAME, strlen(WG_GENL_NAME) + 1);
+        if ((ret = genl_request(&req.nlh, family_reply, &wg_family)) != 0)
+                return ret;
+        return (wg_family == -1 ? -ENOENT : 0);
+}
+
+static void device_reply(struct nlattr *attrs, int len, void *data) {
+        struct tunnel *tunnel = data;
+        time_t now = time(NULL);
+
+        for_each_attr(attr, attrs, len) {
+                if (ATTR_TYPE(attr) != WGDEVICE_A_PEERS)
+                        continue;
+                /* A large device is split into several messages, each
+                 * containing some of the peers. A peer whose allowed IPs do
+                 * not fit is repeated in the next message with only its
+                 * public key and the remaining allowed IPs, so peers are
+                 * counted by their statistics, which are only sent once. */
+                for_each_attr(peer, ATTR_DATA(attr), ATTR_LEN(attr)) {
+                        for_each_attr(peer_attr, ATTR_DATA(peer), ATTR_LEN(peer)) {
+                                switch (ATTR_TYPE(peer_attr)) {
+                                        case WGPEER_A_LAST_HANDSHAKE_TIME: {
+                                                /* A struct __kernel_timespec,
+                                                 * starting with the 64 bit
+                                                 * tv_sec. */
+                                                int64_t sec;
+                                                memcpy(&sec, ATTR_DATA(peer_attr), sizeof(sec));
+                                                if (sec == 0)
+                                                        break;
+                                                if (sec > tunnel->last_handshake)
+                                                        tunnel->last_handshake = sec;
+                                                if (now - sec < WG_HANDSHAKE_TIMEOUT)
+                                                        tunnel->peers_up++;
+                                                break;
+                                        }
+                                        case WGPEER_A_RX_BYTES:
+                                                tunnel->peers++;
+                                                tunnel->rx_bytes += *(uint64_t *)ATTR_DATA(peer_attr);
+                                                break;
+                                        case WGPEER_A_TX_BYTES:
+                                                tunnel->tx_bytes += *(uint64_t *)ATTR_DATA(peer_attr);
+                                                break;
+                                }
+                        }
+                }
+        }
+}
+
+/*
+ * Queries the peers of a WireGuard interface with a single WG_CMD_GET_DEVICE
+ * dump. This needs the cap_net_admin capability. Failed queries are retried
+ * with exponential backoff.
+ *
+ */
+static void wg_query(struct tunnel *tunnel) {
+        struct genl_request req;
+        time_t now = time(NULL);
+        int ret;
+
+        if (now < tunnel->next_query)
+                return;
+
+        if ((ret = wg_init()) == 0) {
+                init_request(&req, wg_family, WG_CMD_GET_DEVICE, NLM_F_DUMP);
+                add_attr(&req.nlh, WGDEVICE_A_IFNAME, tunnel->interface, strlen(tunnel->interface) + 1);
+
+                tunnel->peers = tunnel->peers_up = 0;
+                tunnel->last_handshake = 0;
+                tunnel->rx_bytes = tunnel->tx_bytes = 0;
+                ret = genl_request(&req.nlh, device_reply, tunnel);
+        }
+
+        if (ret == 0) {
+                tunnel->wg_valid = true;
+                tunnel->backoff = 0;
+                return;
+        }
+
+        if (tunnel->backoff == 0)
+                stats_error("Cannot query WireGuard interface %s: %s", tunnel->interface, strerror(-ret));
+        tunnel->wg_valid = false;
+        tunnel->backoff = (tunnel->backoff == 0 ? 1 : (tunnel->backoff * 2 > WG_MAX_BACKOFF ? WG_MAX_BACKOFF : tunnel->backoff * 2));
+        tunnel->next_query = now + tunnel->backoff;
+}
+
+/*
+ * Returns whether the interface is a WireGuard interface, according to the
+ * DEVTYPE in its sysfs uevent file.
+ *
+ */
+static bool is_wireguard(const char *interface) {
+        char path[128], buf[512];
+
+        (void)snprintf(path, sizeof(path), "/sys/class/net/%s/uevent", interface);
+        return (slurp(path, buf, sizeof(buf)) && strstr(buf, "DEVTYPE=wireguard\n") != NULL);
+}
+#endif
+
+static struct tunnel *get_tunnel(const char *interface) {
+        struct tunnel *tunnel;
+
+        TAILQ_FOREACH(tunnel, &tunnels, tunnels) {
+                if (strcmp(tunnel->interface, interface) == 0)
+                        return tunnel;
+        }
+        if ((tunnel = calloc(1, sizeof(struct tunnel))) == NULL ||
+            (tunnel->interface = strdup(interface)) == NULL)
+                die("Error: out of memory\n");
+        TAILQ_INSERT_TAIL(&tunnels, tunnel, tunnels);
+        return tunnel;
+}
+
+static int print_age(char *outwalk, time_t age) {
+        if (age < 60)
+                return sprintf(outwalk, "%lds", (long)age);
+        if (age < 3600)
+                return sprintf(outwalk, "%ldm", (long)age / 60);
+        return sprintf(outwalk, "%ldh", (long)age / 3600);
+}
+
+/*
+ * Shows whether a VPN tunnel interface is up, using the cached interface
+ * state. For WireGuard interfaces, the peers’ handshakes and traffic are shown
+ * as well; the block is colored degraded while no peer had a recent
+ * handshake.
+ *
+ */
+void print_tunnel(yajl_gen json_gen, char *buffer, const char *interface, const char *format_up, const char *format_down, const char *prefix_type) {
+        const char *walk;
+        char *outwalk = buffer;
+        const struct if_addrs *addrs = get_if_addrs(interface);
+        struct tunnel *tunnel = get_tunnel(interface);
+        unsigned long generation = ifstate_generation();
+
+        INSTANCE(interface);
+
+        if (addrs == NULL) {
+                START_COLOR("color_bad");
+                outwalk += sprintf(outwalk, "%s", format_down);
+                goto out;
+        }
+
+        if (tunnel->generation != generation) {
+                tunnel->generation = generation;
+#if defined(LINUX)
+                tunnel->is_wireguard = is_wireguard(interface);
+                /* The interface may have been re-created, try right away. */
+                tunnel->next_query = 0;
+                tunnel->backoff = 0;
+#endif
+        }
+
+#if defined(LINUX)
+        if (tunnel->is_wireguard)
+                wg_query(tunnel);
+#endif
+
+        if (tunnel->is_wireguard && tunnel->wg_valid && tunnel->peers_up == 0)
+                START_COLOR("color_degraded");
+        else START_COLOR("color_good");
+
+        for (walk = format_up; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+
+                bool wg = (tunnel->is_wireguard && tunnel->wg_valid);
+                if (BEGINS_WITH(walk+1, "ip")) {
+                        outwalk += print_ip_addr(outwalk, addrs, false);
+                        walk += strlen("ip");
+                } else if (BEGINS_WITH(walk+1, "handshake")) {
+                        if (wg && tunnel->last_handshake != 0)
+                                outwalk += print_age(outwalk, time(NULL) - tunnel->last_handshake);
+                        else outwalk += sprintf(outwalk, (wg ? "never" : "?"));
+                        walk += strlen("handshake");
+                } else if (BEGINS_WITH(walk+1, "peers_up")) {
+                        outwalk += (wg ? sprintf(outwalk, "%d", tunnel->peers_up) : sprintf(outwalk, "?"));
+                        walk += strlen("peers_up");
+                } else if (BEGINS_WITH(walk+1, "peers")) {
+                        outwalk += (wg ? sprintf(outwalk, "%d", tunnel->peers) : sprintf(outwalk, "?"));
+                        walk += strlen("peers");
+                } else if (BEGINS_WITH(walk+1, "rx")) {
+                        outwalk += (wg ? print_bytes_human(outwalk, tunnel->rx_bytes, prefix_type) : sprintf(outwalk, "?"));
+                        walk += strlen("rx");
+                } else if (BEGINS_WITH(walk+1, "tx")) {
+                        outwalk += (wg ? print_bytes_human(outwalk, tunnel->tx_bytes, prefix_type) : sprintf(outwalk, "?"));
+                        walk += strlen("tx");
+                }
+        }
+
+out:
+        END_COLOR;
+        OUTPUT_FULL_TEXT(buffer);
+}
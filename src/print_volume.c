@@ -9,6 +9,7 @@
 #ifdef LINUX
 #include <alsa/asoundlib.h>
 #include <alloca.h>
+#include <poll.h>
 #endif
 
 #if defined(__FreeBSD__) || defined(__DragonFly__)
@@ -26,9 +27,256 @@
 #include "i3status.h"
 #include "queue.h"
 
-void print_volume(yajl_gen json_gen, char *buffer, const char *fmt, const char *fmt_muted, const char *device, const char *mixer, int mixer_idx) {
+/*
+ * Everything the placeholders show. Values which are unknown (e.g. because
+ * the mixer has no capture element) are -1, or has_db is false.
+ *
+ */
+struct volume_snapshot {
+        int volume;
+        int volume_left;
+        int volume_right;
+        bool muted;
+        bool has_db;
+        /* in hundredths of a dB */
+        long db;
+        int capture;
+        int mic_muted;
+};
+
+#define PRINT_KNOWN(condition, fmt, value) \
+        (condition ? sprintf(outwalk, fmt, value) : sprintf(outwalk, "?"))
+
+static char *apply_volume_format(const char *fmt, char *outwalk, const struct volume_snapshot *snap) {
+        const char *walk = fmt;
+
+        for (; *walk != '\0'; walk++) {
+                if (*walk != '%') {
+                        *(outwalk++) = *walk;
+                        continue;
+                }
+                if (BEGINS_WITH(walk+1, "%")) {
+                        outwalk += sprintf(outwalk, "%%");
+                        walk += strlen("%");
+                } else if (BEGINS_WITH(walk+1, "volume_left")) {
+                        outwalk += PRINT_KNOWN(snap->volume_left >= 0, "%d%%", snap->volume_left);
+                        walk += strlen("volume_left");
+                } else if (BEGINS_WITH(walk+1, "volume_right")) {
+                        outwalk += PRINT_KNOWN(snap->volume_right >= 0, "%d%%", snap->volume_right);
+                        walk += strlen("volume_right");
+                } else if (BEGINS_WITH(walk+1, "volume")) {
+                        outwalk += sprintf(outwalk, "%d%%", snap->volume);
+                        walk += strlen("volume");
+                } else if (BEGINS_WITH(walk+1, "db")) {
+                        outwalk += PRINT_KNOWN(snap->has_db, "%.1f dB", snap->db / 100.0);
+                        walk += strlen("db");
+                } else if (BEGINS_WITH(walk+1, "capture")) {
+                        outwalk += PRINT_KNOWN(snap->capture >= 0, "%d%%", snap->capture);
+                        walk += strlen("capture");
+                } else if (BEGINS_WITH(walk+1, "mic_muted")) {
+                        outwalk += PRINT_KNOWN(snap->mic_muted >= 0, "%s", (snap->mic_muted ? "muted" : "on"));
+                        walk += strlen("mic_muted");
+                }
+        }
+        return outwalk;
+}
+
+#ifdef LINUX
+#define MAX_MIXER_FDS 8
+
+/*
+ * An ALSA mixer which stays open. Its poll descriptors are watched by the
+ * event loop, and the snapshot of the element is only read again when the
+ * mixer reports an event (volume changed, mute toggled, …).
+ *
+ */
+struct alsa_mixer {
+        char *device;
+        char *mixer;
+        int mixer_idx;
+        char *capture_mixer;
+
+        snd_mixer_t *m;
+        snd_mixer_elem_t *elem;
+        /* The element with the capture controls: the mixer element itself if
+         * it has any, otherwise capture_mixer, or NULL. */
+        snd_mixer_elem_t *capture_elem;
+        int num_fds;
+        int fds[MAX_MIXER_FDS];
+
+        struct volume_snapshot snapshot;
+
+        TAILQ_ENTRY(alsa_mixer) mixers;
+};
+
+static TAILQ_HEAD(mixers_head, alsa_mixer) mixers = TAILQ_HEAD_INITIALIZER(mixers);
+
+static int volume_percent(long val, long max) {
+        if (max == 100)
+                return (int)val;
+        float avgf = ((float)val / max) * 100;
+        int avg = (int)avgf;
+        return (avgf - avg < 0.5 ? avg : (avg+1));
+}
+
+static void read_snapshot(struct alsa_mixer *mx) {
+        struct volume_snapshot *snap = &mx->snapshot;
+        snd_mixer_elem_t *elem = mx->elem;
+        long min, max, val;
+        int err, sw;
+
+        snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
+        snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_FRONT_LEFT, &val);
+        snap->volume = snap->volume_left = volume_percent(val, max);
+        if (snd_mixer_selem_is_playback_mono(elem)) {
+                snap->volume_right = snap->volume_left;
+        } else {
+                snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_FRONT_RIGHT, &val);
+                snap->volume_right = volume_percent(val, max);
+        }
+
+        snap->has_db = (snd_mixer_selem_get_playback_dB(elem, SND_MIXER_SCHN_FRONT_LEFT, &snap->db) == 0);
+
+        snap->muted = false;
+        if (snd_mixer_selem_has_playback_switch(elem)) {
+                if ((err = snd_mixer_selem_get_playback_switch(elem, SND_MIXER_SCHN_FRONT_LEFT, &sw)) < 0)
+                        stats_error("ALSA: playback_switch: %s", snd_strerror(err));
+                else snap->muted = !sw;
+        }
+
+        snap->capture = snap->mic_muted = -1;
+        if (mx->capture_elem == NULL)
+                return;
+        if (snd_mixer_selem_has_capture_volume(mx->capture_elem)) {
+                snd_mixer_selem_get_capture_volume_range(mx->capture_elem, &min, &max);
+                snd_mixer_selem_get_capture_volume(mx->capture_elem, SND_MIXER_SCHN_FRONT_LEFT, &val);
+                snap->capture = volume_percent(val, max);
+        }
+        if (snd_mixer_selem_has_capture_switch(mx->capture_elem) &&
+            snd_mixer_selem_get_capture_switch(mx->capture_elem, SND_MIXER_SCHN_FRONT_LEFT, &sw) == 0)
+                snap->mic_muted = !sw;
+}
+
+static void close_mixer(struct alsa_mixer *mx) {
+        for (int i = 0; i < mx->num_fds; i++)
+                events_remove(mx->fds[i]);
+        mx->num_fds = 0;
+        if (mx->m != NULL)
+                snd_mixer_close(mx->m);
+        mx->m = NULL;
+        mx->elem = mx->capture_elem = NULL;
+}
+
+static void mixer_event(int fd, short revents, void *data) {
+        struct alsa_mixer *mx = data;
+
+        if (mx->m == NULL)
+                return;
+        /* The device went away (e.g. a USB headset was unplugged). The mixer
+         * is opened again on the next update. */
+        if ((revents & (POLLERR | POLLHUP | POLLNVAL)) || snd_mixer_handle_events(mx->m) < 0) {
+                close_mixer(mx);
+        } else {
+                read_snapshot(mx);
+        }
+        events_request_refresh(mx);
+}
+
+static snd_mixer_elem_t *find_elem(snd_mixer_t *m, const char *name, int idx) {
+        snd_mixer_selem_id_t *sid;
+        snd_mixer_elem_t *elem;
+
+        snd_mixer_selem_id_alloca(&sid);
+        snd_mixer_selem_id_set_index(sid, idx);
+        snd_mixer_selem_id_set_name(sid, name);
+        elem = snd_mixer_find_selem(m, sid);
+        return elem;
+}
+
+static bool open_mixer(struct alsa_mixer *mx) {
+        struct pollfd pfds[MAX_MIXER_FDS];
+        int err;
+
+        if ((err = snd_mixer_open(&mx->m, 0)) < 0) {
+                stats_error("ALSA: Cannot open mixer: %s", snd_strerror(err));
+                mx->m = NULL;
+                return false;
+        }
+
+        /* Attach this mixer handle to the given device */
+        if ((err = snd_mixer_attach(mx->m, mx->device)) < 0) {
+                stats_error("ALSA: Cannot attach mixer to device: %s", snd_strerror(err));
+                goto error;
+        }
+
+        /* Register this mixer */
+        if ((err = snd_mixer_selem_register(mx->m, NULL, NULL)) < 0) {
+                stats_error("ALSA: snd_mixer_selem_register: %s", snd_strerror(err));
+                goto error;
+        }
+
+        if ((err = snd_mixer_load(mx->m)) < 0) {
+                stats_error("ALSA: snd_mixer_load: %s", snd_strerror(err));
+                goto error;
+        }
+
+        /* Find the given mixer */
+        if (!(mx->elem = find_elem(mx->m, mx->mixer, mx->mixer_idx))) {
+                stats_error("ALSA: Cannot find mixer %s (index %i)", mx->mixer, mx->mixer_idx);
+                goto error;
+        }
+        if (snd_mixer_selem_has_capture_volume(mx->elem) || snd_mixer_selem_has_capture_switch(mx->elem))
+                mx->capture_elem = mx->elem;
+        else if (mx->capture_mixer != NULL && *mx->capture_mixer != '\0')
+                mx->capture_elem = find_elem(mx->m, mx->capture_mixer, 0);
+
+        int num_fds = snd_mixer_poll_descriptors(mx->m, pfds, MAX_MIXER_FDS);
+        for (int i = 0; i < num_fds; i++) {
+                events_add(pfds[i].fd, pfds[i].events, mixer_event, mx);
+                mx->fds[mx->num_fds++] = pfds[i].fd;
+        }
+
+        read_snapshot(mx);
+        return true;
+
+error:
+        close_mixer(mx);
+        return false;
+}
+
+/*
+ * Returns the mixer for the given element, opening it if necessary, or NULL
+ * if it cannot be opened.
+ *
+ */
+static struct alsa_mixer *get_mixer(const char *device, const char *mixer, int mixer_idx, const char *capture_mixer) {
+        struct alsa_mixer *mx;
+
+        TAILQ_FOREACH(mx, &mixers, mixers) {
+                if (strcmp(mx->device, device) == 0 && strcmp(mx->mixer, mixer) == 0 &&
+                    mx->mixer_idx == mixer_idx && strcmp(mx->capture_mixer, capture_mixer) == 0)
+                        break;
+        }
+        if (mx == NULL) {
+                if ((mx = calloc(1, sizeof(struct alsa_mixer))) == NULL ||
+                    (mx->device = strdup(device)) == NULL ||
+                    (mx->mixer = strdup(mixer)) == NULL ||
+                    (mx->capture_mixer = strdup(capture_mixer)) == NULL)
+                        die("Error: out of memory\n");
+                mx->mixer_idx = mixer_idx;
+                TAILQ_INSERT_TAIL(&mixers, mx, mixers);
+        }
+
+        if (mx->m == NULL && !open_mixer(mx))
+                return NULL;
+        return mx;
+}
+#endif
+
+void print_volume(yajl_gen json_gen, char *buffer, const char *fmt, const char *fmt_muted, const char *device, const char *mixer, int mixer_idx, const char *capture_mixer) {
         char *outwalk = buffer;
 	int pbval = 1;
+        struct volume_snapshot snap = {.volume_left = -1, .volume_right = -1, .has_db = false, .capture = -1, .mic_muted = -1};
 
         /* Printing volume only works with ALSA at the moment */
         if (output_format == O_I3BAR) {
@@ -37,95 +285,38 @@ void print_volume(yajl_gen json_gen, char *buffer, const char *fmt, const char *
                 INSTANCE(instance);
                 free(instance);
         }
+
+        /* With device "pulse" or "pulse:<sink>", the volume of the default
+         * or the given sink is taken from PulseAudio (or pipewire-pulse).
+         * Without a server, ALSA’s default device is used. */
+        if (BEGINS_WITH(device, "pulse")) {
+                const char *sink = (device[strlen("pulse")] == ':' ? device + strlen("pulse:") : NULL);
+
+                if (pulse_volume(sink, &snap.volume, &snap.muted)) {
+                        if (snap.muted) {
+                                START_COLOR("color_degraded");
+                                fmt = fmt_muted;
+                                pbval = 0;
+                        }
+                        outwalk = apply_volume_format(fmt, outwalk, &snap);
+                        goto out;
+                }
+                device = "default";
+        }
 #ifdef LINUX
-	int err;
-	snd_mixer_t *m;
-	snd_mixer_selem_id_t *sid;
-	snd_mixer_elem_t *elem;
-	long min, max, val;
-	int avg;
-
-	if ((err = snd_mixer_open(&m, 0)) < 0) {
-		fprintf(stderr, "i3status: ALSA: Cannot open mixer: %s\n", snd_strerror(err));
-		goto out;
-	}
-
-	/* Attach this mixer handle to the given device */
-	if ((err = snd_mixer_attach(m, device)) < 0) {
-		fprintf(stderr, "i3status: ALSA: Cannot attach mixer to device: %s\n", snd_strerror(err));
-		snd_mixer_close(m);
-		goto out;
-	}
-
-	/* Register this mixer */
-	if ((err = snd_mixer_selem_register(m, NULL, NULL)) < 0) {
-		fprintf(stderr, "i3status: ALSA: snd_mixer_selem_register: %s\n", snd_strerror(err));
-		snd_mixer_close(m);
-		goto out;
-	}
-
-	if ((err = snd_mixer_load(m)) < 0) {
-		fprintf(stderr, "i3status: ALSA: snd_mixer_load: %s\n", snd_strerror(err));
-		snd_mixer_close(m);
-		goto out;
-	}
-
-	snd_mixer_selem_id_malloc(&sid);
-	if (sid == NULL) {
-		snd_mixer_close(m);
-		goto out;
-	}
-
-	/* Find the given mixer */
-	snd_mixer_selem_id_set_index(sid, mixer_idx);
-	snd_mixer_selem_id_set_name(sid, mixer);
-	if (!(elem = snd_mixer_find_selem(m, sid))) {
-		fprintf(stderr, "i3status: ALSA: Cannot find mixer %s (index %i)\n",
-			snd_mixer_selem_id_get_name(sid), snd_mixer_selem_id_get_index(sid));
-		snd_mixer_close(m);
-		snd_mixer_selem_id_free(sid);
-		goto out;
-	}
-
-	/* Get the volume range to convert the volume later */
-	snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-
-	snd_mixer_handle_events (m);
-	snd_mixer_selem_get_playback_volume (elem, 0, &val);
-	if (max != 100) {
-		float avgf = ((float)val / max) * 100;
-		avg = (int)avgf;
-		avg = (avgf - avg < 0.5 ? avg : (avg+1));
-	} else avg = (int)val;
-
-	/* Check for mute */
-	if (snd_mixer_selem_has_playback_switch(elem)) {
-		if ((err = snd_mixer_selem_get_playback_switch(elem, 0, &pbval)) < 0)
-			fprintf (stderr, "i3status: ALSA: playback_switch: %s\n", snd_strerror(err));
-		if (!pbval)  {
-			START_COLOR("color_degraded");
-			fmt = fmt_muted;
-		}
-	}
-
-	snd_mixer_close(m);
-	snd_mixer_selem_id_free(sid);
-
-	const char *walk = fmt;
-	for (; *walk != '\0'; walk++) {
-		if (*walk != '%') {
-                        *(outwalk++) = *walk;
-			continue;
-		}
-		if (BEGINS_WITH(walk+1, "%")) {
-			outwalk += sprintf(outwalk, "%%");
-			walk += strlen("%");
-		}
-		if (BEGINS_WITH(walk+1, "volume")) {
-			outwalk += sprintf(outwalk, "%d%%", avg);
-			walk += strlen("volume");
-		}
-	}
+        struct alsa_mixer *mx = get_mixer(device, mixer, mixer_idx, capture_mixer);
+        if (mx == NULL)
+                goto out;
+        events_depend(mx);
+
+        snap = mx->snapshot;
+        if (snap.muted) {
+                START_COLOR("color_degraded");
+                fmt = fmt_muted;
+                pbval = 0;
+        }
+
+        outwalk = apply_volume_format(fmt, outwalk, &snap);
 #endif
 #if defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
         char *mixerpath;
@@ -154,21 +345,9 @@ void print_volume(yajl_gen json_gen, char *buffer, const char *fmt, const char *
                 pbval = 0;
         }
 
-        const char *walk = fmt;
-        for (; *walk != '\0'; walk++) {
-                if (*walk != '%') {
-                        *(outwalk++) = *walk;
-                        continue;
-                }
-                if (BEGINS_WITH(walk+1, "%")) {
-                        outwalk += sprintf(outwalk, "%%");
-                        walk += strlen("%");
-                }
-                if (BEGINS_WITH(walk+1, "volume")) {
-                        outwalk += sprintf(outwalk, "%d%%", vol & 0x7f);
-                        walk += strlen("volume");
-                }
-        }
+        snap.volume = snap.volume_left = vol & 0x7f;
+        snap.volume_right = (vol >> 8) & 0x7f;
+        outwalk = apply_volume_format(fmt, outwalk, &snap);
         close(mixfd);
 #endif
 
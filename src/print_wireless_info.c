@@ -1,11 +1,15 @@
 // vim:ts=8:expandtab
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <yajl/yajl_gen.h>
 #include <yajl/yajl_version.h>
 
 #ifdef LINUX
 #include <iwlib.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include "queue.h"
 #else
 #ifndef __FreeBSD__
 #define IW_ESSID_MAX_SIZE 32
@@ -71,36 +75,181 @@ typedef struct {
         int bitrate;
 } wireless_info_t;
 
+#ifdef LINUX
+/*
+ * What only changes when the interface (re)associates: the configuration
+ * (ESSID, mode), the range of the quality values and the bitrate. They are
+ * read using ioctls and kept until ifstate reports a change of the
+ * interface, which includes wireless (association) events.
+ *
+ */
+struct wireless_iface {
+        char *name;
+        unsigned long generation;
+        bool valid;
+        wireless_config wcfg;
+        iwrange range;
+        int bitrate;
+
+        TAILQ_ENTRY(wireless_iface) ifaces;
+};
+
+static TAILQ_HEAD(ifaces_head, wireless_iface) ifaces = TAILQ_HEAD_INITIALIZER(ifaces);
+
+static struct wireless_iface *get_wireless_iface(const char *interface) {
+        struct wireless_iface *wif;
+        unsigned long generation = ifstate_generation();
+
+        TAILQ_FOREACH(wif, &ifaces, ifaces) {
+                if (strcmp(wif->name, interface) == 0)
+                        break;
+        }
+        if (wif == NULL) {
+                if ((wif = calloc(1, sizeof(struct wireless_iface))) == NULL ||
+                    (wif->name = strdup(interface)) == NULL)
+                        die("Error: out of memory\n");
+                TAILQ_INSERT_TAIL(&ifaces, wif, ifaces);
+        } else if (wif->generation == generation) {
+                return wif;
+        }
+
+        struct iwreq wrq;
+        wif->generation = generation;
+        wif->valid = (iw_get_basic_config(general_socket, interface, &wif->wcfg) >= 0 &&
+                      iw_get_range_info(general_socket, interface, &wif->range) >= 0);
+        wif->bitrate = 0;
+        if (wif->valid && iw_get_ext(general_socket, interface, SIOCGIWRATE, &wrq) >= 0)
+                wif->bitrate = wrq.u.bitrate.value;
+        return wif;
+}
+
+/*
+ * The link quality, signal and noise level of all wireless interfaces, as
+ * listed in /proc/net/wireless. The file is read once per tick (through a
+ * file descriptor which is kept open) for all wireless blocks.
+ *
+ */
+#define MAX_PROC_WIRELESS 16
+
+static struct {
+        char name[IFNAMSIZ];
+        iwqual qual;
+} proc_wireless[MAX_PROC_WIRELESS];
+static int num_proc_wireless = 0;
+static int proc_wireless_fd = -1;
+static unsigned long proc_wireless_tick = (unsigned long)-1;
+
+/*
+ * Parses a value of /proc/net/wireless, which the kernel prints followed by
+ * '.' if it was updated since the file was last read. A missing '.' does not
+ * make the value invalid: for drivers with persistent statistics, the kernel
+ * clears the updated flags after printing, so another reader may have come
+ * first. Levels in dBm are printed as negative numbers, but iwqual stores
+ * them in 8 bits, hence the +256 (which is what the kernel subtracted). -256
+ * is what an unknown level (0, e.g. the noise of cfg80211 drivers) becomes,
+ * so that is the only value considered invalid.
+ *
+ */
+static char *parse_proc_value(char *walk, __u8 *value, iwqual *qual, int updated, int invalid) {
+        long parsed = strtol(walk, &walk, 10);
+
+        if (parsed == -256)
+                qual->updated |= invalid;
+        if (parsed < 0) {
+                qual->updated |= IW_QUAL_DBM;
+                parsed += 256;
+        }
+        *value = (__u8)parsed;
+        if (*walk == '.') {
+                qual->updated |= updated;
+                walk++;
+        }
+        return walk;
+}
+
+static void read_proc_wireless(void) {
+        static char buf[4096];
+        ssize_t n;
+        char *line, *walk;
+
+        num_proc_wireless = 0;
+        if (proc_wireless_fd == -1 &&
+            (proc_wireless_fd = open_rooted("/proc/net/wireless", O_RDONLY | O_CLOEXEC)) == -1)
+                return;
+        if ((n = pread(proc_wireless_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+                return;
+        buf[n] = '\0';
+
+        /* The first two lines are headers. Then, each line looks like
+         * " wlan0: 0000   54.  -56.  -256   0 0 0 0 61   0". */
+        line = strchr(buf, '\n');
+        if (line != NULL)
+                line = strchr(line + 1, '\n');
+        while (line != NULL && num_proc_wireless < MAX_PROC_WIRELESS) {
+                line++;
+                while (*line == ' ')
+                        line++;
+                if ((walk = strchr(line, ':')) == NULL || walk - line >= IFNAMSIZ)
+                        break;
+
+                memset(&proc_wireless[num_proc_wireless], 0, sizeof(proc_wireless[0]));
+                iwqual *qual = &proc_wireless[num_proc_wireless].qual;
+                memcpy(proc_wireless[num_proc_wireless].name, line, walk - line);
+
+                /* skip the status */
+                (void)strtol(walk + 1, &walk, 16);
+                walk = parse_proc_value(walk, &qual->qual, qual, IW_QUAL_QUAL_UPDATED, IW_QUAL_QUAL_INVALID);
+                walk = parse_proc_value(walk, &qual->level, qual, IW_QUAL_LEVEL_UPDATED, IW_QUAL_LEVEL_INVALID);
+                walk = parse_proc_value(walk, &qual->noise, qual, IW_QUAL_NOISE_UPDATED, IW_QUAL_NOISE_INVALID);
+                num_proc_wireless++;
+
+                line = strchr(walk, '\n');
+        }
+}
+
+/*
+ * Gets the statistics of the interface from /proc/net/wireless. Returns false
+ * if it is not listed, in which case they have to be queried using ioctls.
+ *
+ */
+static bool get_proc_wireless(const char *interface, iwstats *stats) {
+        if (proc_wireless_tick != stats_ticks()) {
+                read_proc_wireless();
+                proc_wireless_tick = stats_ticks();
+        }
+
+        for (int i = 0; i < num_proc_wireless; i++) {
+                if (strcmp(proc_wireless[i].name, interface) == 0) {
+                        memset(stats, 0, sizeof(iwstats));
+                        stats->qual = proc_wireless[i].qual;
+                        return true;
+                }
+        }
+        return false;
+}
+#endif
+
 static int get_wireless_info(const char *interface, wireless_info_t *info) {
         memset(info, 0, sizeof(wireless_info_t));
 
 #ifdef LINUX
-        int skfd = iw_sockets_open();
-        if (skfd < 0) {
-                perror("iw_sockets_open");
+        struct wireless_iface *wif = get_wireless_iface(interface);
+        if (!wif->valid)
                 return 0;
-        }
-
-        wireless_config wcfg;
-        if (iw_get_basic_config(skfd, interface, &wcfg) < 0) {
-            close(skfd);
-            return 0;
-        }
 
-        if (wcfg.has_essid && wcfg.essid_on) {
+        if (wif->wcfg.has_essid && wif->wcfg.essid_on) {
                 info->flags |= WIRELESS_INFO_FLAG_HAS_ESSID;
-                strncpy(&info->essid[0], wcfg.essid, IW_ESSID_MAX_SIZE);
+                strncpy(&info->essid[0], wif->wcfg.essid, IW_ESSID_MAX_SIZE);
                 info->essid[IW_ESSID_MAX_SIZE] = '\0';
         }
+        info->bitrate = wif->bitrate;
 
         /* If the function iw_get_stats does not return proper stats, the
            wifi is considered as down.
            Since ad-hoc network does not have theses stats, we need to return
            here for this mode. */
-        if (wcfg.mode == 1) {
-                close(skfd);
+        if (wif->wcfg.mode == 1)
                 return 1;
-        }
 
         /* Wireless quality is a relative value in a driver-specific range.
            Signal and noise level can be either relative or absolute values
@@ -111,23 +260,17 @@ static int get_wireless_info(const char *interface, wireless_info_t *info) {
            8-bit arithmetic on them. Assume absolute values if everything
            else fails (driver bug). */
 
-        iwrange range;
-        if (iw_get_range_info(skfd, interface, &range) < 0) {
-                close(skfd);
-                return 0;
-        }
-
+        const iwrange *range = &wif->range;
         iwstats stats;
-        if (iw_get_stats(skfd, interface, &stats, &range, 1) < 0) {
-                close(skfd);
+        if (!get_proc_wireless(interface, &stats) &&
+            iw_get_stats(general_socket, interface, &stats, range, 1) < 0)
                 return 0;
-        }
 
         if (stats.qual.level != 0 || (stats.qual.updated & (IW_QUAL_DBM | IW_QUAL_RCPI))) {
                 if (!(stats.qual.updated & IW_QUAL_QUAL_INVALID)) {
                         info->quality = stats.qual.qual;
-                        info->quality_max = range.max_qual.qual;
-                        info->quality_average = range.avg_qual.qual;
+                        info->quality_max = range->max_qual.qual;
+                        info->quality_average = range->avg_qual.qual;
                         info->flags |= WIRELESS_INFO_FLAG_HAS_QUALITY;
                 }
 
@@ -142,7 +285,7 @@ static int get_wireless_info(const char *interface, wireless_info_t *info) {
                         }
                 }
                 else {
-                        if ((stats.qual.updated & IW_QUAL_DBM) || stats.qual.level > range.max_qual.level) {
+                        if ((stats.qual.updated & IW_QUAL_DBM) || stats.qual.level > range->max_qual.level) {
                                 if (!(stats.qual.updated & IW_QUAL_LEVEL_INVALID)) {
                                         info->signal_level = stats.qual.level;
                                         if (info->signal_level > 63)
@@ -159,12 +302,12 @@ static int get_wireless_info(const char *interface, wireless_info_t *info) {
                         else {
                                 if (!(stats.qual.updated & IW_QUAL_LEVEL_INVALID)) {
                                         info->signal_level = stats.qual.level;
-                                        info->signal_level_max = range.max_qual.level;
+                                        info->signal_level_max = range->max_qual.level;
                                         info->flags |= WIRELESS_INFO_FLAG_HAS_SIGNAL;
                                 }
                                 if (!(stats.qual.updated & IW_QUAL_NOISE_INVALID)) {
                                         info->noise_level = stats.qual.noise;
-                                        info->noise_level_max = range.max_qual.noise;
+                                        info->noise_level_max = range->max_qual.noise;
                                         info->flags |= WIRELESS_INFO_FLAG_HAS_NOISE;
                                 }
                         }
@@ -185,11 +328,6 @@ static int get_wireless_info(const char *interface, wireless_info_t *info) {
                 }
         }
 
-        struct iwreq wrq;
-        if (iw_get_ext(skfd, interface, SIOCGIWRATE, &wrq) >= 0)
-                info->bitrate = wrq.u.bitrate.value;
-
-        close(skfd);
         return 1;
 #endif
 #if defined(__FreeBSD__) || defined(__DragonFly__)
@@ -229,7 +367,7 @@ static int get_wireless_info(const char *interface, wireless_info_t *info) {
         na.i_len = sizeof(buf);
 
         if (ioctl(s, SIOCG80211, (caddr_t)&na) == -1) {
-                printf("fail\n");
+                stats_error("SIOCG80211 failed: %s", strerror(errno));
                 close(s);
                 return (0);
         }
@@ -327,8 +465,8 @@ void print_wireless_info(yajl_gen json_gen, char *buffer, const char *interface,
 
         INSTANCE(interface);
 
-	const char *ip_address = get_ip_addr(interface);
-	if (ip_address == NULL) {
+	const struct if_addrs *addrs = get_if_addrs(interface);
+	if (addrs == NULL) {
 		START_COLOR("color_bad");
 		outwalk += sprintf(outwalk, "%s", format_down);
 		goto out;
@@ -395,9 +533,18 @@ void print_wireless_info(yajl_gen json_gen, char *buffer, const char *interface,
                         walk += strlen("essid");
                 }
 
-                if (BEGINS_WITH(walk+1, "ip")) {
-			outwalk += sprintf(outwalk, "%s", ip_address);
-			walk += strlen("ip");
+                if (BEGINS_WITH(walk+1, "ip4")) {
+                        outwalk += print_ip_addrs(outwalk, addrs, AF_INET);
+                        walk += strlen("ip4");
+                } else if (BEGINS_WITH(walk+1, "ip6")) {
+                        outwalk += print_ip_addrs(outwalk, addrs, AF_INET6);
+                        walk += strlen("ip6");
+                } else if (BEGINS_WITH(walk+1, "cidr")) {
+                        outwalk += print_ip_addr(outwalk, addrs, true);
+                        walk += strlen("cidr");
+                } else if (BEGINS_WITH(walk+1, "ip")) {
+                        outwalk += print_ip_addr(outwalk, addrs, false);
+                        walk += strlen("ip");
                 }
 
 #ifdef LINUX
@@ -0,0 +1,587 @@
+// vim:ts=8:expandtab
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "i3status.h"
+
+/*
+ * A minimal client for the PulseAudio native protocol, which pipewire-pulse
+ * speaks as well. It keeps one connection to the server, which is watched by
+ * the event loop, and subscribes to sink and server events. The volume and
+ * mute state of the sinks used by volume blocks are kept in memory and
+ * requested again whenever the server reports a change, so rendering a block
+ * does not wait for the server (except for the very first time). Like the
+ * D-Bus client, it implements just the few commands it needs instead of
+ * linking against libpulse.
+ *
+ * The protocol is not formally specified; see pulsecore/native-common.h,
+ * pulsecore/tagstruct.c and pulsecore/pstream.c in the PulseAudio sources.
+ *
+ */
+
+#define PA_PROTOCOL_VERSION 32
+#define PA_COOKIE_LENGTH 256
+#define PA_VOLUME_NORM 0x10000
+#define PA_INVALID_INDEX 0xFFFFFFFF
+
+/* Every packet starts with a descriptor of five 32-bit big-endian integers:
+ * the length of the payload, the channel (audio streams use their own
+ * channels), two offset fields and flags. */
+#define PA_DESCRIPTOR_SIZE 20
+#define PA_CHANNEL_COMMAND 0xFFFFFFFF
+
+#define PA_COMMAND_ERROR 0
+#define PA_COMMAND_REPLY 2
+#define PA_COMMAND_AUTH 8
+#define PA_COMMAND_SET_CLIENT_NAME 9
+#define PA_COMMAND_GET_SINK_INFO 21
+#define PA_COMMAND_SUBSCRIBE 35
+#define PA_COMMAND_SUBSCRIBE_EVENT 66
+
+#define PA_SUBSCRIPTION_MASK_SINK 0x0001
+#define PA_SUBSCRIPTION_MASK_SERVER 0x0080
+#define PA_SUBSCRIPTION_EVENT_FACILITY_MASK 0x000F
+#define PA_SUBSCRIPTION_EVENT_SINK 0x0000
+#define PA_SUBSCRIPTION_EVENT_SERVER 0x0007
+
+#define PA_TAG_STRING 't'
+#define PA_TAG_STRING_NULL 'N'
+#define PA_TAG_U32 'L'
+#define PA_TAG_SAMPLE_SPEC 'a'
+#define PA_TAG_ARBITRARY 'x'
+#define PA_TAG_BOOLEAN_TRUE '1'
+#define PA_TAG_BOOLEAN_FALSE '0'
+#define PA_TAG_CHANNEL_MAP 'm'
+#define PA_TAG_CVOLUME 'v'
+#define PA_TAG_PROPLIST 'P'
+
+#define PULSE_MESSAGE_SIZE 1024
+/* Sink info replies contain property lists and can be several KiB. */
+#define PULSE_RECEIVE_SIZE 65536
+
+/* Seconds to wait for the server to answer, and between attempts to
+ * connect. */
+#define PULSE_TIMEOUT 1
+#define PULSE_RECONNECT_INTERVAL 10
+
+/* The tags of our requests. Sink info requests use TAG_SINK plus the index
+ * of the sink in sinks[]. */
+#define TAG_AUTH 0
+#define TAG_CLIENT_NAME 1
+#define TAG_SUBSCRIBE 2
+#define TAG_SINK 16
+
+#define MAX_SINKS 8
+
+struct pulse_sink {
+        /* The name of the sink, or NULL for the default sink. */
+        char *name;
+        /* Whether volume and muted are known, an info request is outstanding
+         * or the server does not know the sink. */
+        bool valid;
+        bool pending;
+        bool missing;
+        int volume;
+        bool muted;
+};
+
+static struct pulse_sink sinks[MAX_SINKS];
+static int num_sinks = 0;
+
+static int pulse_fd = -1;
+static time_t next_connect = 0;
+/* The command of the last reply to one of the requests sent while
+ * connecting, or -1 while it is outstanding. */
+static int64_t handshake_reply = -1;
+
+static unsigned char recv_buf[PULSE_RECEIVE_SIZE];
+static size_t recv_len = 0;
+
+struct pulse_message {
+        unsigned char buf[PULSE_MESSAGE_SIZE];
+        size_t len;
+        bool overflow;
+};
+
+static void msg_put(struct pulse_message *msg, const void *data, size_t len) {
+        if (msg->len + len > PULSE_MESSAGE_SIZE) {
+                msg->overflow = true;
+                return;
+        }
+        memcpy(msg->buf + msg->len, data, len);
+        msg->len += len;
+}
+
+static void msg_put_tag(struct pulse_message *msg, uint8_t tag) {
+        msg_put(msg, &tag, 1);
+}
+
+static void msg_put_raw_u32(struct pulse_message *msg, uint32_t value) {
+        value = htonl(value);
+        msg_put(msg, &value, sizeof(value));
+}
+
+static void msg_put_u32(struct pulse_message *msg, uint32_t value) {
+        msg_put_tag(msg, PA_TAG_U32);
+        msg_put_raw_u32(msg, value);
+}
+
+static void msg_put_string(struct pulse_message *msg, const char *str) {
+        if (str == NULL) {
+                msg_put_tag(msg, PA_TAG_STRING_NULL);
+                return;
+        }
+        msg_put_tag(msg, PA_TAG_STRING);
+        msg_put(msg, str, strlen(str) + 1);
+}
+
+static void msg_put_arbitrary(struct pulse_message *msg, const void *data, size_t len) {
+        msg_put_tag(msg, PA_TAG_ARBITRARY);
+        msg_put_raw_u32(msg, len);
+        msg_put(msg, data, len);
+}
+
+/*
+ * Starts a command packet. The descriptor is filled in by pulse_send().
+ *
+ */
+static void msg_command(struct pulse_message *msg, uint32_t command, uint32_t tag) {
+        msg->len = PA_DESCRIPTOR_SIZE;
+        msg->overflow = false;
+        msg_put_u32(msg, command);
+        msg_put_u32(msg, tag);
+}
+
+/*
+ * Reads the values of a received packet. Any mismatch sets error, after which
+ * all further reads fail as well.
+ *
+ */
+struct pulse_reader {
+        const unsigned char *buf;
+        size_t len;
+        size_t pos;
+        bool error;
+};
+
+static bool read_tag(struct pulse_reader *reader, uint8_t tag, size_t len) {
+        if (reader->error || reader->pos + 1 + len > reader->len || reader->buf[reader->pos] != tag) {
+                reader->error = true;
+                return false;
+        }
+        reader->pos++;
+        return true;
+}
+
+static uint32_t read_raw_u32(struct pulse_reader *reader) {
+        uint32_t value;
+        memcpy(&value, reader->buf + reader->pos, sizeof(value));
+        reader->pos += sizeof(value);
+        return ntohl(value);
+}
+
+static uint32_t read_u32(struct pulse_reader *reader) {
+        if (!read_tag(reader, PA_TAG_U32, 4))
+                return 0;
+        return read_raw_u32(reader);
+}
+
+static void skip_string(struct pulse_reader *reader) {
+        if (reader->pos < reader->len && reader->buf[reader->pos] == PA_TAG_STRING_NULL) {
+                reader->pos++;
+                return;
+        }
+        if (!read_tag(reader, PA_TAG_STRING, 0))
+                return;
+        const unsigned char *end = memchr(reader->buf + reader->pos, '\0', reader->len - reader->pos);
+        if (end == NULL) {
+                reader->error = true;
+                return;
+        }
+        reader->pos = end - reader->buf + 1;
+}
+
+static bool read_bool(struct pulse_reader *reader) {
+        if (reader->pos < reader->len && reader->buf[reader->pos] == PA_TAG_BOOLEAN_TRUE)
+                return read_tag(reader, PA_TAG_BOOLEAN_TRUE, 0);
+        (void)read_tag(reader, PA_TAG_BOOLEAN_FALSE, 0);
+        return false;
+}
+
+/*
+ * Reads the start of a value which consists of a count byte followed by count
+ * values of the given size (channel maps and volumes) and returns the count.
+ *
+ */
+static uint8_t read_counted(struct pulse_reader *reader, uint8_t tag, size_t size) {
+        if (!read_tag(reader, tag, 1))
+                return 0;
+        uint8_t count = reader->buf[reader->pos++];
+        if (reader->pos + count * size > reader->len) {
+                reader->error = true;
+                return 0;
+        }
+        return count;
+}
+
+static bool pulse_send(struct pulse_message *msg) {
+        uint32_t descriptor[5] = {htonl(msg->len - PA_DESCRIPTOR_SIZE), htonl(PA_CHANNEL_COMMAND), 0, 0, 0};
+        const unsigned char *walk = msg->buf;
+        size_t len = msg->len;
+
+        if (msg->overflow)
+                return false;
+        memcpy(msg->buf, descriptor, sizeof(descriptor));
+
+        while (len > 0) {
+                /* MSG_NOSIGNAL: a server going away must not trigger our
+                 * SIGPIPE handler, which would make i3status exit. */
+                ssize_t n = send(pulse_fd, walk, len, MSG_NOSIGNAL);
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        return false;
+                }
+                walk += n;
+                len -= n;
+        }
+        return true;
+}
+
+static void pulse_disconnect(void) {
+        if (pulse_fd != -1) {
+                events_remove(pulse_fd);
+                (void)close(pulse_fd);
+        }
+        pulse_fd = -1;
+        recv_len = 0;
+        next_connect = time(NULL) + PULSE_RECONNECT_INTERVAL;
+        for (int i = 0; i < num_sinks; i++)
+                sinks[i].valid = sinks[i].pending = sinks[i].missing = false;
+}
+
+static void request_sink_info(int i) {
+        struct pulse_message msg;
+
+        if (sinks[i].pending)
+                return;
+        msg_command(&msg, PA_COMMAND_GET_SINK_INFO, TAG_SINK + i);
+        msg_put_u32(&msg, PA_INVALID_INDEX);
+        msg_put_string(&msg, (sinks[i].name != NULL ? sinks[i].name : "@DEFAULT_SINK@"));
+        if (!pulse_send(&msg)) {
+                pulse_disconnect();
+                return;
+        }
+        sinks[i].pending = true;
+}
+
+/*
+ * Handles the reply to a sink info request. Of the sink info, we need the
+ * volume and mute state; everything after them is ignored.
+ *
+ */
+static void handle_sink_info(struct pulse_sink *sink, uint32_t command, struct pulse_reader *reader) {
+        uint8_t channels;
+        uint64_t sum = 0;
+
+        sink->pending = false;
+        if (command != PA_COMMAND_REPLY) {
+                sink->valid = false;
+                sink->missing = true;
+                events_request_refresh(sink);
+                return;
+        }
+
+        (void)read_u32(reader);                                 /* index */
+        skip_string(reader);                                    /* name */
+        skip_string(reader);                                    /* description */
+        if (read_tag(reader, PA_TAG_SAMPLE_SPEC, 6))
+                reader->pos += 6;
+        reader->pos += read_counted(reader, PA_TAG_CHANNEL_MAP, 1);
+        (void)read_u32(reader);                                 /* owner module */
+        channels = read_counted(reader, PA_TAG_CVOLUME, 4);
+        for (int i = 0; i < channels; i++)
+                sum += read_raw_u32(reader);
+        bool muted = read_bool(reader);
+
+        if (reader->error || channels == 0) {
+                stats_error("PulseAudio: cannot parse sink info");
+                sink->valid = false;
+                return;
+        }
+
+        sink->volume = (sum / channels * 100 + PA_VOLUME_NORM / 2) / PA_VOLUME_NORM;
+        sink->muted = muted;
+        sink->valid = true;
+        sink->missing = false;
+        events_request_refresh(sink);
+}
+
+static void handle_packet(const unsigned char *buf, size_t len) {
+        struct pulse_reader reader = {.buf = buf, .len = len, .pos = 0, .error = false};
+        uint32_t command = read_u32(&reader);
+        uint32_t tag = read_u32(&reader);
+
+        if (reader.error)
+                return;
+
+        if (command == PA_COMMAND_SUBSCRIBE_EVENT) {
+                uint32_t facility = read_u32(&reader) & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+                /* Server events include a change of the default sink. A new
+                 * sink may be one which was missing so far. */
+                if (facility == PA_SUBSCRIPTION_EVENT_SINK || facility == PA_SUBSCRIPTION_EVENT_SERVER) {
+                        for (int i = 0; i < num_sinks && pulse_fd != -1; i++)
+                                request_sink_info(i);
+                }
+        } else if (command == PA_COMMAND_REPLY || command == PA_COMMAND_ERROR) {
+                if (tag >= TAG_SINK && tag < TAG_SINK + (uint32_t)num_sinks)
+                        handle_sink_info(&sinks[tag - TAG_SINK], command, &reader);
+                else if (tag < TAG_SINK)
+                        handshake_reply = command;
+        }
+}
+
+/*
+ * Reads whatever the server sent and handles all complete packets. With
+ * wait, blocks (up to PULSE_TIMEOUT) until something arrives. Returns false
+ * if nothing arrived.
+ *
+ */
+static bool pulse_receive(bool wait) {
+        bool received = false;
+        ssize_t n = -1;
+
+        while (pulse_fd != -1 &&
+               (n = recv(pulse_fd, recv_buf + recv_len, sizeof(recv_buf) - recv_len, (wait ? 0 : MSG_DONTWAIT))) != 0) {
+                if (n == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno != EAGAIN && errno != EWOULDBLOCK)
+                                pulse_disconnect();
+                        break;
+                }
+                recv_len += n;
+                received = true;
+                wait = false;
+
+                size_t pos = 0;
+                while (recv_len - pos >= PA_DESCRIPTOR_SIZE) {
+                        uint32_t descriptor[5];
+                        memcpy(descriptor, recv_buf + pos, sizeof(descriptor));
+                        size_t len = ntohl(descriptor[0]);
+
+                        if (len > sizeof(recv_buf) - PA_DESCRIPTOR_SIZE) {
+                                stats_error("PulseAudio: packet too large (%zu bytes)", len);
+                                pulse_disconnect();
+                                return received;
+                        }
+                        if (recv_len - pos < PA_DESCRIPTOR_SIZE + len)
+                                break;
+                        if (ntohl(descriptor[1]) == PA_CHANNEL_COMMAND)
+                                handle_packet(recv_buf + pos + PA_DESCRIPTOR_SIZE, len);
+                        pos += PA_DESCRIPTOR_SIZE + len;
+                        if (pulse_fd == -1)
+                                return received;
+                }
+                memmove(recv_buf, recv_buf + pos, recv_len - pos);
+                recv_len -= pos;
+        }
+
+        if (n == 0)
+                pulse_disconnect();
+        return received;
+}
+
+static void pulse_event(int fd, short revents, void *data) {
+        (void)pulse_receive(false);
+}
+
+/*
+ * Sends a request while connecting and waits for its reply.
+ *
+ */
+static bool pulse_handshake(struct pulse_message *msg) {
+        handshake_reply = -1;
+        if (!pulse_send(msg))
+                return false;
+        while (pulse_fd != -1 && handshake_reply == -1) {
+                if (!pulse_receive(true))
+                        return false;
+        }
+        return (handshake_reply == PA_COMMAND_REPLY);
+}
+
+/*
+ * Reads the authentication cookie from $PULSE_COOKIE, ~/.config/pulse/cookie
+ * or ~/.pulse-cookie. Servers which do not need one (like pipewire-pulse)
+ * accept any cookie.
+ *
+ */
+static void read_cookie(unsigned char cookie[PA_COOKIE_LENGTH]) {
+        const char *home = getenv("HOME");
+        char path[256];
+        int fd = -1;
+
+        memset(cookie, 0, PA_COOKIE_LENGTH);
+        if (getenv("PULSE_COOKIE") != NULL)
+                fd = open(getenv("PULSE_COOKIE"), O_RDONLY | O_CLOEXEC);
+        if (fd == -1 && home != NULL) {
+                (void)snprintf(path, sizeof(path), "%s/.config/pulse/cookie", home);
+                if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+                        (void)snprintf(path, sizeof(path), "%s/.pulse-cookie", home);
+                        fd = open(path, O_RDONLY | O_CLOEXEC);
+                }
+        }
+        if (fd == -1)
+                return;
+        if (read(fd, cookie, PA_COOKIE_LENGTH) != PA_COOKIE_LENGTH)
+                memset(cookie, 0, PA_COOKIE_LENGTH);
+        (void)close(fd);
+}
+
+/*
+ * Fills in the socket address of the server, taken from $PULSE_SERVER (only
+ * local sockets are supported) or $XDG_RUNTIME_DIR/pulse/native.
+ *
+ */
+static bool server_address(struct sockaddr_un *addr) {
+        const char *server = getenv("PULSE_SERVER");
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        int len;
+
+        memset(addr, 0, sizeof(struct sockaddr_un));
+        addr->sun_family = AF_UNIX;
+
+        if (server != NULL) {
+                if (BEGINS_WITH(server, "unix:"))
+                        server += strlen("unix:");
+                if (*server != '/')
+                        return false;
+                len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", server);
+        } else {
+                if (runtime_dir == NULL)
+                        return false;
+                len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/pulse/native", runtime_dir);
+        }
+        return (len > 0 && (size_t)len < sizeof(addr->sun_path));
+}
+
+/*
+ * Connects to the server, authenticates, and subscribes to sink and server
+ * events.
+ *
+ */
+static bool pulse_connect(void) {
+        struct sockaddr_un addr;
+        struct timeval timeout = {PULSE_TIMEOUT, 0};
+        struct pulse_message msg;
+        unsigned char cookie[PA_COOKIE_LENGTH];
+        const char *name = "i3status";
+
+        if (!server_address(&addr))
+                return false;
+
+        if ((pulse_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+                return false;
+
+        (void)setsockopt(pulse_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        (void)setsockopt(pulse_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        if (connect(pulse_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+                goto error;
+
+        /* We never use shared memory, so the version goes without the flags
+         * announcing shm/memfd support. */
+        read_cookie(cookie);
+        msg_command(&msg, PA_COMMAND_AUTH, TAG_AUTH);
+        msg_put_u32(&msg, PA_PROTOCOL_VERSION);
+        msg_put_arbitrary(&msg, cookie, sizeof(cookie));
+        if (!pulse_handshake(&msg))
+                goto error;
+
+        /* The client name is a property list of key, length and value. */
+        msg_command(&msg, PA_COMMAND_SET_CLIENT_NAME, TAG_CLIENT_NAME);
+        msg_put_tag(&msg, PA_TAG_PROPLIST);
+        msg_put_string(&msg, "application.name");
+        msg_put_u32(&msg, strlen(name) + 1);
+        msg_put_arbitrary(&msg, name, strlen(name) + 1);
+        msg_put_string(&msg, NULL);
+        if (!pulse_handshake(&msg))
+                goto error;
+
+        msg_command(&msg, PA_COMMAND_SUBSCRIBE, TAG_SUBSCRIBE);
+        msg_put_u32(&msg, PA_SUBSCRIPTION_MASK_SINK | PA_SUBSCRIPTION_MASK_SERVER);
+        if (!pulse_handshake(&msg))
+                goto error;
+
+        events_add(pulse_fd, POLLIN, pulse_event, NULL);
+        return true;
+
+error:
+        if (pulse_fd != -1)
+                (void)close(pulse_fd);
+        pulse_fd = -1;
+        recv_len = 0;
+        return false;
+}
+
+/*
+ * Gets the volume (in percent) and mute state of the given sink, or of the
+ * default sink if sink is NULL. Returns false if there is no PulseAudio
+ * server or it does not know the sink.
+ *
+ */
+bool pulse_volume(const char *sink, int *volume, bool *muted) {
+        int i;
+
+        for (i = 0; i < num_sinks; i++) {
+                if ((sink == NULL && sinks[i].name == NULL) ||
+                    (sink != NULL && sinks[i].name != NULL && strcmp(sinks[i].name, sink) == 0))
+                        break;
+        }
+        if (i == num_sinks) {
+                if (num_sinks == MAX_SINKS)
+                        return false;
+                memset(&sinks[i], 0, sizeof(struct pulse_sink));
+                if (sink != NULL && (sinks[i].name = strdup(sink)) == NULL)
+                        die("Error: out of memory\n");
+                num_sinks++;
+        }
+        events_depend(&sinks[i]);
+
+        if (pulse_fd == -1) {
+                if (time(NULL) < next_connect)
+                        return false;
+                if (!pulse_connect()) {
+                        next_connect = time(NULL) + PULSE_RECONNECT_INTERVAL;
+                        return false;
+                }
+        }
+
+        /* The first time, wait for the server to answer. Afterwards, the
+         * sink is kept up to date by events. */
+        if (!sinks[i].valid && !sinks[i].missing) {
+                request_sink_info(i);
+                while (pulse_fd != -1 && sinks[i].pending && pulse_receive(true))
+                        ;
+        }
+
+        if (!sinks[i].valid)
+                return false;
+        *volume = sinks[i].volume;
+        *muted = sinks[i].muted;
+        return true;
+}
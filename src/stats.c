@@ -0,0 +1,277 @@
+// vim:ts=8:expandtab
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <yajl/yajl_gen.h>
+#include <yajl/yajl_version.h>
+
+#include "i3status.h"
+
+/*
+ * Counters about i3status itself: how long each block takes to render, how
+ * often it failed and whether the value it shows is stale. They are shown by
+ * the "self" module and served as JSON on the optional stats socket.
+ *
+ */
+
+struct block_stats {
+        const char *name;
+        double last_render_ms;
+        unsigned long refreshes;
+        unsigned long errors;
+        char last_error[256];
+        /* Whether the last render reported an error, i.e. the block shows an
+         * error message or an outdated value. */
+        bool stale;
+        bool error_in_render;
+};
+
+static struct block_stats *blocks;
+static unsigned int num_blocks;
+/* The block which is currently being rendered, or NULL between blocks. */
+static struct block_stats *current;
+
+static unsigned long ticks;
+static unsigned long overruns;
+static double last_tick_ms;
+static double tick_start_ms;
+static double block_start_ms;
+
+static char *socket_path;
+
+void stats_init(unsigned int blocks_in_order) {
+        num_blocks = blocks_in_order;
+        if ((blocks = calloc(num_blocks, sizeof(struct block_stats))) == NULL)
+                die("Error: out of memory (calloc())\n");
+}
+
+void stats_tick_start(void) {
+        tick_start_ms = events_monotonic_seconds() * 1e3;
+}
+
+void stats_tick_end(void) {
+        last_tick_ms = events_monotonic_seconds() * 1e3 - tick_start_ms;
+        ticks++;
+}
+
+/*
+ * Counts a tick which took longer than the time until the next update.
+ *
+ */
+void stats_overrun(void) {
+        overruns++;
+}
+
+unsigned long stats_overruns(void) {
+        return overruns;
+}
+
+/*
+ * Returns the number of status lines generated so far. The value does not
+ * change while a line is being rendered, so modules which share work between
+ * blocks use it to do that work once per tick.
+ *
+ */
+unsigned long stats_ticks(void) {
+        return ticks;
+}
+
+void stats_block_start(unsigned int block, const char *name) {
+        current = &blocks[block];
+        current->name = name;
+        current->error_in_render = false;
+        block_start_ms = events_monotonic_seconds() * 1e3;
+}
+
+void stats_block_end(void) {
+        current->last_render_ms = events_monotonic_seconds() * 1e3 - block_start_ms;
+        current->refreshes++;
+        current->stale = current->error_in_render;
+        current = NULL;
+}
+
+/*
+ * Reports an error of the block which is currently being rendered. The message
+ * is recorded as the block’s last error and printed to stderr (prefixed with
+ * "i3status: "), unless it is the same as the block’s previous error: many
+ * errors repeat on every update and would flood the session log.
+ *
+ */
+void stats_error(const char *fmt, ...) {
+        static char last_error[256];
+        char message[256];
+        va_list ap;
+
+        va_start(ap, fmt);
+        (void)vsnprintf(message, sizeof(message), fmt, ap);
+        va_end(ap);
+
+        char *last = (current != NULL ? current->last_error : last_error);
+        if (strcmp(last, message) != 0)
+                fprintf(stderr, "i3status: %s\n", message);
+        (void)snprintf(last, sizeof(last_error), "%s", message);
+
+        if (current == NULL)
+                return;
+        current->errors++;
+        current->error_in_render = true;
+}
+
+double stats_last_tick_ms(void) {
+        return last_tick_ms;
+}
+
+unsigned long stats_total_errors(void) {
+        unsigned long errors = 0;
+        for (unsigned int i = 0; i < num_blocks; i++)
+                errors += blocks[i].errors;
+        return errors;
+}
+
+unsigned int stats_stale_blocks(void) {
+        unsigned int stale = 0;
+        for (unsigned int i = 0; i < num_blocks; i++)
+                stale += blocks[i].stale;
+        return stale;
+}
+
+/*
+ * Returns our resident set size in bytes, or 0 if it cannot be determined.
+ * /proc/self/statm is kept open, so this costs a single pread().
+ *
+ */
+unsigned long long stats_rss(void) {
+#if defined(LINUX)
+        static int statm_fd = -1;
+        char buf[128];
+        ssize_t n;
+        unsigned long long resident;
+
+        if (statm_fd == -1 && (statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC)) == -1)
+                return 0;
+        if ((n = pread(statm_fd, buf, sizeof(buf) - 1, 0)) <= 0)
+                return 0;
+        buf[n] = '\0';
+
+        /* The format is "size resident shared text lib data dt" in pages. */
+        if (sscanf(buf, "%*u %llu", &resident) != 1)
+                return 0;
+        return resident * sysconf(_SC_PAGESIZE);
+#else
+        return 0;
+#endif
+}
+
+#define JSON_KEY(str) yajl_gen_string(json_gen, (const unsigned char *)str, strlen(str))
+
+/*
+ * Sends all counters as one JSON object to the given client.
+ *
+ */
+static void send_stats(int fd) {
+        const unsigned char *buf;
+#if YAJL_MAJOR >= 2
+        size_t len;
+        yajl_gen json_gen = yajl_gen_alloc(NULL);
+#else
+        unsigned int len;
+        yajl_gen json_gen = yajl_gen_alloc(NULL, NULL);
+#endif
+
+        yajl_gen_map_open(json_gen);
+        JSON_KEY("ticks");
+        yajl_gen_integer(json_gen, ticks);
+        JSON_KEY("overruns");
+        yajl_gen_integer(json_gen, overruns);
+        JSON_KEY("tick_ms");
+        yajl_gen_double(json_gen, last_tick_ms);
+        JSON_KEY("rss");
+        yajl_gen_integer(json_gen, stats_rss());
+        JSON_KEY("blocks");
+        yajl_gen_array_open(json_gen);
+        for (unsigned int i = 0; i < num_blocks; i++) {
+                /* Blocks which were never rendered (e.g. because of a typo in
+                 * the order) have no name yet. */
+                if (blocks[i].name == NULL)
+                        continue;
+                yajl_gen_map_open(json_gen);
+                JSON_KEY("name");
+                JSON_KEY(blocks[i].name);
+                JSON_KEY("last_render_ms");
+                yajl_gen_double(json_gen, blocks[i].last_render_ms);
+                JSON_KEY("refreshes");
+                yajl_gen_integer(json_gen, blocks[i].refreshes);
+                JSON_KEY("errors");
+                yajl_gen_integer(json_gen, blocks[i].errors);
+                JSON_KEY("last_error");
+                if (blocks[i].errors > 0)
+                        JSON_KEY(blocks[i].last_error);
+                else yajl_gen_null(json_gen);
+                JSON_KEY("stale");
+                yajl_gen_bool(json_gen, blocks[i].stale);
+                yajl_gen_map_close(json_gen);
+        }
+        yajl_gen_array_close(json_gen);
+        yajl_gen_map_close(json_gen);
+
+        yajl_gen_get_buf(json_gen, &buf, &len);
+        /* The output is small enough to fit into the socket buffer. A client
+         * which does not read must not block us, so don’t wait. */
+        (void)send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        (void)send(fd, "\n", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        yajl_gen_free(json_gen);
+}
+
+static void stats_accept(int fd, short revents, void *data) {
+        int client;
+
+        while ((client = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+                send_stats(client);
+                (void)close(client);
+        }
+}
+
+static void remove_socket(void) {
+        (void)unlink(socket_path);
+}
+
+/*
+ * Listens on a UNIX socket at path. Every client connecting to it is sent the
+ * current stats as JSON, after which the connection is closed.
+ *
+ */
+void stats_listen(const char *path) {
+        struct sockaddr_un addr;
+        int fd;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path))
+                die("stats_socket path too long: \"%s\"\n", path);
+        strcpy(addr.sun_path, path);
+
+        if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) == -1)
+                die("Could not create stats socket: %s\n", strerror(errno));
+
+        /* Remove a stale socket of a previous instance. */
+        (void)unlink(path);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+                die("Could not bind stats socket to \"%s\": %s\n", path, strerror(errno));
+        if (listen(fd, 4) == -1)
+                die("Could not listen on stats socket: %s\n", strerror(errno));
+
+        if ((socket_path = strdup(path)) == NULL)
+                die("Error: out of memory (strdup())\n");
+        atexit(remove_socket);
+
+        events_add(fd, POLLIN, stats_accept, NULL);
+}
@@ -0,0 +1,117 @@
+// vim:ts=8:expandtab
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "i3status.h"
+
+/*
+ * Kernel uevents (devices appearing, CPUs going online, AC adapters being
+ * plugged in, …) received through a single NETLINK_KOBJECT_UEVENT socket which
+ * is watched by the event loop. Modules subscribe to the subsystems they are
+ * interested in instead of polling sysfs every tick.
+ *
+ */
+
+#if defined(LINUX)
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#define MAX_SUBSCRIBERS 8
+
+struct subscriber {
+        const char *subsystem;
+        uevent_cb cb;
+        void *data;
+};
+
+static struct subscriber subscribers[MAX_SUBSCRIBERS];
+static int num_subscribers = 0;
+static int uevent_fd = -1;
+
+/*
+ * Returns the value of the given key (e.g. "ACTION") of a uevent, or NULL.
+ *
+ */
+const char *uevent_get(const struct uevent *event, const char *key) {
+        size_t key_len = strlen(key);
+
+        for (const char *walk = event->buf; walk < event->buf + event->len; walk += strlen(walk) + 1)
+                if (strncmp(walk, key, key_len) == 0 && walk[key_len] == '=')
+                        return walk + key_len + 1;
+        return NULL;
+}
+
+static void uevent_receive(int fd, short revents, void *data) {
+        char buf[8192];
+        ssize_t n;
+
+        while ((n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+                struct uevent event = {.buf = buf, .len = n};
+                buf[n] = '\0';
+
+                /* Messages from the kernel start with "action@devpath",
+                 * followed by NUL-separated KEY=value pairs. Skip anything
+                 * else (e.g. messages relayed by udev). */
+                if (strchr(buf, '@') == NULL)
+                        continue;
+                event.action = uevent_get(&event, "ACTION");
+                event.devpath = uevent_get(&event, "DEVPATH");
+                event.subsystem = uevent_get(&event, "SUBSYSTEM");
+                if (event.action == NULL || event.devpath == NULL || event.subsystem == NULL)
+                        continue;
+
+                for (int i = 0; i < num_subscribers; i++)
+                        if (strcmp(subscribers[i].subsystem, event.subsystem) == 0)
+                                subscribers[i].cb(&event, subscribers[i].data);
+        }
+}
+
+/*
+ * Calls cb for every uevent of the given subsystem (e.g. "cpu" or
+ * "power_supply"). The netlink socket is opened with the first subscription.
+ * Returns false if uevents are not available, in which case callers should
+ * fall back to polling.
+ *
+ */
+bool uevent_subscribe(const char *subsystem, uevent_cb cb, void *data) {
+        if (uevent_fd == -1) {
+                struct sockaddr_nl addr;
+
+                memset(&addr, 0, sizeof(addr));
+                addr.nl_family = AF_NETLINK;
+                /* Group 1 receives the events as sent by the kernel. */
+                addr.nl_groups = 1;
+
+                if ((uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT)) == -1)
+                        return false;
+                if (bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+                        fprintf(stderr, "i3status: Cannot subscribe to uevents: %s\n", strerror(errno));
+                        (void)close(uevent_fd);
+                        uevent_fd = -1;
+                        return false;
+                }
+                events_add(uevent_fd, POLLIN, uevent_receive, NULL);
+        }
+
+        if (num_subscribers == MAX_SUBSCRIBERS)
+                die("Too many uevent subscribers (max %d)\n", MAX_SUBSCRIBERS);
+        subscribers[num_subscribers].subsystem = subsystem;
+        subscribers[num_subscribers].cb = cb;
+        subscribers[num_subscribers].data = data;
+        num_subscribers++;
+        return true;
+}
+#else
+const char *uevent_get(const struct uevent *event, const char *key) {
+        return NULL;
+}
+
+bool uevent_subscribe(const char *subsystem, uevent_cb cb, void *data) {
+        return false;
+}
+#endif